@@ -0,0 +1,153 @@
+#include "ConcurrentTripleSet.h"
+
+namespace {
+constexpr uint64_t REGULAR_BIT = 1ULL << 63;
+}
+
+ConcurrentTripleSet::ConcurrentTripleSet() {
+    for (auto& segment : segments) {
+        segment.store(nullptr, std::memory_order_relaxed);
+    }
+    bucketSlot(0, true)->store(&head, std::memory_order_release);
+}
+
+ConcurrentTripleSet::~ConcurrentTripleSet() {
+    Node* node = head.next.load(std::memory_order_relaxed);
+    while (node != nullptr) {
+        Node* next = node->next.load(std::memory_order_relaxed);
+        delete node;
+        node = next;
+    }
+    for (auto& segment : segments) {
+        delete[] segment.load(std::memory_order_relaxed);
+    }
+}
+
+uint64_t ConcurrentTripleSet::reverseBits(uint64_t value) {
+    value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+    value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+    value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(value);
+}
+
+size_t ConcurrentTripleSet::parentBucket(size_t bucket) {
+    return bucket & ~(static_cast<size_t>(1) << (63 - __builtin_clzll(bucket)));
+}
+
+std::atomic<ConcurrentTripleSet::Node*>* ConcurrentTripleSet::bucketSlot(size_t bucket, bool create) const {
+    size_t segment = bucket < 2 ? 0 : static_cast<size_t>(63 - __builtin_clzll(bucket));
+    size_t offset = segment == 0 ? bucket : bucket - (static_cast<size_t>(1) << segment);
+    std::atomic<Node*>* slots = segments[segment].load(std::memory_order_acquire);
+    if (slots == nullptr) {
+        if (!create) {
+            return nullptr;
+        }
+        size_t length = segment == 0 ? 2 : static_cast<size_t>(1) << segment;
+        auto* allocated = new std::atomic<Node*>[length]();
+        // 多个线程同时分配同一段时只保留一个
+        if (segments[segment].compare_exchange_strong(slots, allocated, std::memory_order_acq_rel)) {
+            slots = allocated;
+        } else {
+            delete[] allocated;
+        }
+    }
+    return slots + offset;
+}
+
+ConcurrentTripleSet::Node* ConcurrentTripleSet::bucketHead(size_t bucket) {
+    std::atomic<Node*>* slot = bucketSlot(bucket, true);
+    Node* sentinel = slot->load(std::memory_order_acquire);
+    if (sentinel != nullptr) {
+        return sentinel;
+    }
+    // 哨兵插在父桶的区间内，之后父桶中属于本桶的节点自然落在它之后
+    Node* parent = bucketHead(parentBucket(bucket));
+    auto* created = new Node();
+    created->key = reverseBits(bucket);
+    sentinel = insertNode(parent, created);
+    if (sentinel != created) {
+        delete created;
+    }
+    slot->store(sentinel, std::memory_order_release);
+    return sentinel;
+}
+
+bool ConcurrentTripleSet::find(Node* start, uint64_t key, const IdTriple& triple, Node*& previous, Node*& current) {
+    previous = start;
+    current = previous->next.load(std::memory_order_acquire);
+    while (current != nullptr) {
+        if (current->key > key) {
+            return false;
+        }
+        // 哈希值完全相同的普通节点按三元组排序，哨兵的键各不相同
+        if (current->key == key) {
+            if ((key & 1) == 0 || current->triple == triple) {
+                return true;
+            }
+            if (triple < current->triple) {
+                return false;
+            }
+        }
+        previous = current;
+        current = current->next.load(std::memory_order_acquire);
+    }
+    return false;
+}
+
+ConcurrentTripleSet::Node* ConcurrentTripleSet::insertNode(Node* start, Node* node) {
+    Node* previous;
+    Node* current;
+    while (true) {
+        if (find(start, node->key, node->triple, previous, current)) {
+            return current;
+        }
+        node->next.store(current, std::memory_order_relaxed);
+        if (previous->next.compare_exchange_weak(current, node, std::memory_order_release, std::memory_order_relaxed)) {
+            return node;
+        }
+        // 节点从不删除，previous 仍在链表中且不大于 node，从它继续查找
+        start = previous;
+    }
+}
+
+bool ConcurrentTripleSet::insert(const IdTriple& triple) {
+    uint64_t hash = IdTripleHash()(triple);
+    uint64_t key = reverseBits(hash | REGULAR_BIT);
+    size_t buckets = bucketCount.load(std::memory_order_acquire);
+    Node* start = bucketHead(hash & (buckets - 1));
+
+    // 先查找，已存在时不分配节点
+    Node* previous;
+    Node* current;
+    if (find(start, key, triple, previous, current)) {
+        return false;
+    }
+    auto* node = new Node();
+    node->key = key;
+    node->triple = triple;
+    if (insertNode(previous, node) != node) {
+        delete node;
+        return false;
+    }
+    if (count.fetch_add(1, std::memory_order_relaxed) + 1 > buckets * LOAD_FACTOR) {
+        bucketCount.compare_exchange_strong(buckets, buckets * 2, std::memory_order_acq_rel);
+    }
+    return true;
+}
+
+bool ConcurrentTripleSet::contains(const IdTriple& triple) const {
+    uint64_t hash = IdTripleHash()(triple);
+    uint64_t key = reverseBits(hash | REGULAR_BIT);
+    // 不初始化新桶，从最近的已初始化祖先桶开始查找
+    size_t bucket = hash & (bucketCount.load(std::memory_order_acquire) - 1);
+    while (true) {
+        std::atomic<Node*>* slot = bucketSlot(bucket, false);
+        Node* sentinel = slot == nullptr ? nullptr : slot->load(std::memory_order_acquire);
+        if (sentinel != nullptr) {
+            Node* previous;
+            Node* current;
+            return find(sentinel, key, triple, previous, current);
+        }
+        bucket = parentBucket(bucket);
+    }
+}
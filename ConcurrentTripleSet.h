@@ -0,0 +1,57 @@
+#ifndef RDFPANDA_STORAGE_CONCURRENTTRIPLESET_H
+#define RDFPANDA_STORAGE_CONCURRENTTRIPLESET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "Trie.h"
+
+// ConcurrentTripleSet：多线程无锁插入的编码三元组集合，只增不删，供并行推理对推出的事实去重
+// 采用分裂序链表（split-ordered list）：所有节点在一条按哈希值位反转排序的单链表上，
+// 桶只是指向链表中哨兵节点的捷径。桶数翻倍时节点不移动，新桶在第一次访问时从父桶分裂出自己的哨兵，
+// 因此扩容不需要停顿。插入是对前驱节点 next 指针的一次 CAS，同一三元组并发插入时只有一个线程成功
+class ConcurrentTripleSet {
+public:
+    ConcurrentTripleSet();
+    ConcurrentTripleSet(const ConcurrentTripleSet&) = delete;
+    ConcurrentTripleSet& operator=(const ConcurrentTripleSet&) = delete;
+    ~ConcurrentTripleSet();
+
+    // 插入三元组，原本不存在时返回 true；多个线程同时插入同一三元组时恰好一个返回 true
+    bool insert(const IdTriple& triple);
+    bool contains(const IdTriple& triple) const;
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+private:
+    struct Node {
+        uint64_t key = 0;  // 哈希值（最高位置 1）按位反转，普通节点最低位为 1；桶的哨兵为桶号按位反转，最低位为 0
+        IdTriple triple;
+        std::atomic<Node*> next{nullptr};
+    };
+
+    static constexpr size_t MAX_SEGMENTS = 48;
+    static constexpr size_t LOAD_FACTOR = 2; // 平均每个桶的节点数超过它时桶数翻倍
+
+    // 第 0 段为桶 0、1，第 s 段（s >= 1）为桶 [2^s, 2^(s+1))，段在第一次用到时分配，之后不再移动
+    mutable std::atomic<std::atomic<Node*>*> segments[MAX_SEGMENTS];
+    std::atomic<size_t> bucketCount{2};
+    std::atomic<size_t> count{0};
+    Node head; // 桶 0 的哨兵，链表头
+
+    static uint64_t reverseBits(uint64_t value);
+    // 去掉最高的 1 位，即分裂出 bucket 的父桶
+    static size_t parentBucket(size_t bucket);
+    // create 为 false 且所在段未分配时返回 nullptr
+    std::atomic<Node*>* bucketSlot(size_t bucket, bool create) const;
+    // 返回桶的哨兵，未初始化时先从父桶分裂
+    Node* bucketHead(size_t bucket);
+    // 从 start 起查找与 (key, triple) 相同的节点，找到时返回 true 并置于 current；
+    // 否则 previous、current 为按序应插入的位置
+    static bool find(Node* start, uint64_t key, const IdTriple& triple, Node*& previous, Node*& current);
+    // 把 node 插入 start 之后的有序位置，已有相同节点时返回该节点，否则返回 node
+    static Node* insertNode(Node* start, Node* node);
+};
+
+
+#endif //RDFPANDA_STORAGE_CONCURRENTTRIPLESET_H
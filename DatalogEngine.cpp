@@ -1,83 +1,107 @@
 #include <algorithm>
+#include <cstdio>
 #include <map>
 #include <set>
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
+#include <functional>
 #include <future>
 #include "DatalogEngine.h"
 
-#include <queue>
+void DatalogEngine::encodeRules(const std::vector<Rule>& sourceRules) {
+    Dictionary& dictionary = store.getDictionary();
+    auto isVariableName = [](const std::string& term) {
+        // 变量以?开头，如"?x"
+        return !term.empty() && term[0] == '?';
+    };
 
-void DatalogEngine::initiateRulesMap() {
-    // 建立规则关于规则体中各模式三元组的谓语的索引，方便迭代中用三元组触发规则的应用
-    for (const auto& rule : rules) {
+    // 先按名字顺序为所有变量编号，使变量 ID 的顺序与变量名的字典序一致
+    std::set<std::string> variableNames;
+    auto collectVariables = [&](const Triple& triple) {
+        for (const std::string* term : {&triple.subject, &triple.predicate, &triple.object}) {
+            if (isVariableName(*term)) variableNames.insert(*term);
+        }
+    };
+    for (const auto& rule : sourceRules) {
+        collectVariables(rule.head);
         for (const auto& triple : rule.body) {
-            if (isVariable(triple.predicate)) {
-                // 变量不作为索引
-                continue;
-            }
-            std::string predicate = triple.predicate;
-
-            if (rulesMap.find(predicate) == rulesMap.end()) {
-                // 如果当前谓语不在map中，则添加
-                rulesMap[predicate] = std::vector<std::pair<size_t, size_t>>();  // 规则下标，规则体中谓语下标
-                // rulesMap[predicate] = std::vector<size_t>();  // 规则下标
-            }
-
-            // 由于按照下标遍历，故每个vector中最后一个元素最大，只需检测是否小于当前规则下标即可防止重复
-            // if (!rulesMap[predicate].empty() && rulesMap[predicate].back() >= &rule - &rules[0]) {
-            //     continue;  // 已存在当前规则下标
-            // }
+            collectVariables(triple);
+        }
+    }
+    for (const auto& name : variableNames) {
+        dictionary.encodeVariable(name);
+    }
 
-            // 向map中谓语对应的规则下标列表中添加当前规则的下标以及该谓语在规则体中的下标
-            rulesMap[predicate].emplace_back(&rule - &rules[0], &triple - &rule.body[0]);
-            // // 向map中谓语对应的规则下标列表中添加当前规则的下标
-            // rulesMap[predicate].emplace_back(&rule - &rules[0]);
+    auto encodeTerm = [&](const std::string& term) {
+        return isVariableName(term) ? dictionary.encodeVariable(term) : dictionary.encode(term);
+    };
+    auto encodeTriple = [&](const Triple& triple) {
+        return IdTriple(encodeTerm(triple.subject), encodeTerm(triple.predicate), encodeTerm(triple.object));
+    };
 
+    for (const auto& rule : sourceRules) {
+        std::vector<IdTriple> body;
+        body.reserve(rule.body.size());
+        for (const auto& triple : rule.body) {
+            body.push_back(encodeTriple(triple));
         }
+        rules.emplace_back(rule.name, std::move(body), encodeTriple(rule.head));
     }
+}
 
-    for(const auto& rule : nonrecursiveRules) {
-        for (const auto& triple : rule.body) {
-            if (isVariable(triple.predicate)) {
-                // 变量不作为索引
-                continue;
-            }
-            std::string predicate = triple.predicate;
+std::vector<IdTriple> DatalogEngine::encodeFacts(const std::vector<Triple>& facts) {
+    std::vector<IdTriple> encoded;
+    encoded.reserve(facts.size());
+    for (const auto& fact : facts) {
+        encoded.push_back(store.encode(fact));
+    }
+    return encoded;
+}
 
-            if (nonrecursiveRulesMap.find(predicate) == nonrecursiveRulesMap.end()) {
-                // 如果当前谓语不在map中，则添加
-                nonrecursiveRulesMap[predicate] = std::vector<std::pair<size_t, size_t>>();  // 规则下标，规则体中谓语下标
-            }
+void DatalogEngine::initiateRulesMap() {
+    // 建立规则关于规则体中各模式三元组的谓语的索引，方便迭代中用三元组触发规则的应用
+    indexRules(rules, rulesMap);
+    indexRules(nonrecursiveRules, nonrecursiveRulesMap);
+    indexRules(recursiveRules, recursiveRulesMap);
+}
 
-            // 向map中谓语对应的规则下标列表中添加当前规则的下标以及该谓语在规则体中的下标
-            nonrecursiveRulesMap[predicate].emplace_back(&rule - &nonrecursiveRules[0], &triple - &rule.body[0]);
-        }
-    }
-    for(const auto& rule : recursiveRules) {
+void DatalogEngine::indexRules(const std::vector<IdRule>& ruleList, RulesMap& rulesIndex) {
+    std::vector<std::pair<size_t, size_t>> wildcards; // 谓语为变量的模式，可被任意谓语的事实触发
+    for (const auto& rule : ruleList) {
         for (const auto& triple : rule.body) {
+            // 向map中谓语对应的规则下标列表中添加当前规则的下标以及该谓语在规则体中的下标
             if (isVariable(triple.predicate)) {
-                // 变量不作为索引
-                continue;
-            }
-            std::string predicate = triple.predicate;
-
-            if (recursiveRulesMap.find(predicate) == recursiveRulesMap.end()) {
-                // 如果当前谓语不在map中，则添加
-                recursiveRulesMap[predicate] = std::vector<std::pair<size_t, size_t>>();  // 规则下标，规则体中谓语下标
+                wildcards.emplace_back(&rule - &ruleList[0], &triple - &rule.body[0]);
+            } else {
+                rulesIndex[triple.predicate].emplace_back(&rule - &ruleList[0], &triple - &rule.body[0]);
             }
-
-            // 向map中谓语对应的规则下标列表中添加当前规则的下标以及该谓语在规则体中的下标
-            recursiveRulesMap[predicate].emplace_back(&rule - &recursiveRules[0], &triple - &rule.body[0]);
         }
     }
+    if (wildcards.empty()) {
+        return;
+    }
+    // 谓语变量模式追加到每个具体谓语的列表中，并单独存放在 NONE 下供索引中没有的谓语使用
+    for (auto& entry : rulesIndex) {
+        entry.second.insert(entry.second.end(), wildcards.begin(), wildcards.end());
+    }
+    rulesIndex[Dictionary::NONE] = std::move(wildcards);
+}
+
+const std::vector<std::pair<size_t, size_t>>& DatalogEngine::triggersOf(const RulesMap& rulesIndex, TermId predicate) {
+    static const std::vector<std::pair<size_t, size_t>> noTriggers;
+    auto it = rulesIndex.find(predicate);
+    if (it == rulesIndex.end()) {
+        it = rulesIndex.find(Dictionary::NONE);
+    }
+    return it == rulesIndex.end() ? noTriggers : it->second;
 }
 
 void DatalogEngine::initiateCounting() {
-    std::vector<Triple> allTriples = store.getAllTriples();
+    std::vector<IdTriple> allTriples = store.getAllIdTriples();
     for (const auto& triple : allTriples) {
         if(nonrecursiveNum.find(triple) == nonrecursiveNum.end()) {
             nonrecursiveNum[triple] = 1;
@@ -85,254 +109,297 @@ void DatalogEngine::initiateCounting() {
     }
 }
 
-void DatalogEngine::reason() {
-    // bool newFactAdded = false;
-    // int epoch = 0;
-
-    // do {
-    // std::cout << "Epoch: " << epoch++ << std::endl;
-    // newFactAdded = false;
-    std::queue<Triple> newFactQueue; // 存储新产生的事实，出队时触发对应规则的应用，并存到事实库中
-
-    // 创建线程池
-    std::vector<std::future<std::vector<Triple>>> futures;
-    std::mutex storeMutex;
-
-    std::atomic<int> reasonCount(0);
-
-    // 先进行第一轮推理，初始时没有新事实，遍历规则逐条应用
-    // int ruleId = 0;
+void DatalogEngine::stratifyRules() {
+    // 节点为规则头的谓语（谓语为变量的规则头合并为 NONE）
+    std::map<TermId, size_t> nodeOf;
+    auto headNode = [&](const IdRule& rule) { return isVariable(rule.head.predicate) ? Dictionary::NONE : rule.head.predicate; };
     for (const auto& rule : rules) {
-        // std::cout << "Applying rule: " << ruleId++ << std::endl;
-        // 使用 std::async 异步执行规则
-        reasonCount++;
-        futures.push_back(std::async(std::launch::async, [&]() {
-            std::vector<Triple> newFacts;
-            std::map<std::string, std::string> bindings;
-            leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, newFacts, bindings);
-            return newFacts;
-        }));
-    }
-
-    // 收集线程结果并合并
-    for (auto& future : futures) {
-        std::vector<Triple> newFacts = future.get();
-        std::lock_guard<std::mutex> lock(storeMutex);
-        for (const auto& triple : newFacts) {
-            if (store.getNodeByTriple(triple) == nullptr) {
-                // store.addTriple(triple);
-                newFactQueue.push(triple);
-                // newFactAdded = true;
+        nodeOf.emplace(headNode(rule), nodeOf.size());
+    }
+    // 规则体中的模式可能读取的节点
+    auto sourcesOf = [&](const IdTriple& pattern) {
+        std::vector<size_t> sources;
+        if (isVariable(pattern.predicate)) {
+            for (const auto& entry : nodeOf) {
+                sources.push_back(entry.second);
+            }
+            return sources;
+        }
+        for (TermId predicate : {pattern.predicate, Dictionary::NONE}) {
+            auto it = nodeOf.find(predicate);
+            if (it != nodeOf.end()) {
+                sources.push_back(it->second);
+            }
+        }
+        return sources;
+    };
+    std::vector<std::vector<size_t>> edges(nodeOf.size()); // 被依赖的节点 -> 依赖它的节点
+    for (const auto& rule : rules) {
+        size_t head = nodeOf[headNode(rule)];
+        for (const auto& pattern : rule.body) {
+            for (size_t source : sourcesOf(pattern)) {
+                edges[source].push_back(head);
             }
         }
     }
 
-
-    std::atomic<int> activeTaskCount(0); // 活动任务计数器
-    std::mutex queueMutex; // 保护队列的互斥锁
-
-    ////////////////////////////////////
-    /*
-    while (!newFactQueue.empty() || activeTaskCount > 0) {
-        reasonCount++;
-        Triple currentTriple("", "", ""); // 当前三元组
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            if (!newFactQueue.empty()) {
-                currentTriple = newFactQueue.front();
-                newFactQueue.pop();
-                activeTaskCount++; // 增加活动任务计数
-            } else {
-                // 队列为空但仍有活动任务，等待其他线程完成
-                std::this_thread::yield();
-                continue;
+    // Tarjan：分量在其可达的分量都输出之后输出，即依赖它的分量在前，逆序即为拓扑序
+    std::vector<size_t> componentOf(nodeOf.size(), SIZE_MAX);
+    std::vector<size_t> index(nodeOf.size(), SIZE_MAX), lowLink(nodeOf.size(), 0);
+    std::vector<bool> onStack(nodeOf.size(), false);
+    std::vector<size_t> stack;
+    size_t nextIndex = 0, componentCount = 0;
+    std::function<void(size_t)> connect = [&](size_t node) {
+        index[node] = lowLink[node] = nextIndex++;
+        stack.push_back(node);
+        onStack[node] = true;
+        for (size_t next : edges[node]) {
+            if (index[next] == SIZE_MAX) {
+                connect(next);
+                lowLink[node] = std::min(lowLink[node], lowLink[next]);
+            } else if (onStack[next]) {
+                lowLink[node] = std::min(lowLink[node], index[next]);
             }
         }
-
-        // 将当前事实加入事实库
-        {
-            std::lock_guard<std::mutex> lock(storeMutex);
-            if (store.getNodeByTriple(currentTriple) == nullptr) {
-                store.addTriple(currentTriple);
-                // newFactAdded = true;
+        if (lowLink[node] == index[node]) {
+            size_t member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                onStack[member] = false;
+                componentOf[member] = componentCount;
+            } while (member != node);
+            componentCount++;
+        }
+    };
+    for (size_t node = 0; node < nodeOf.size(); node++) {
+        if (index[node] == SIZE_MAX) {
+            connect(node);
+        }
+    }
+    // 分量编号逆序为拓扑序
+    auto order = [&](size_t node) { return componentCount - 1 - componentOf[node]; };
+
+    std::vector<Stratum> components(componentCount);
+    ruleStratum.assign(rules.size(), 0);
+    for (size_t i = 0; i < rules.size(); i++) {
+        const IdRule& rule = rules[i];
+        size_t head = nodeOf[headNode(rule)];
+        Stratum& stratum = components[order(head)];
+        bool isRecursive = false;
+        for (const auto& pattern : rule.body) {
+            for (size_t source : sourcesOf(pattern)) {
+                isRecursive = isRecursive || componentOf[source] == componentOf[head];
             }
         }
-
-        // 异步处理当前三元组
-        std::future<void> future = std::async(std::launch::async, [&, currentTriple]() {
-            // 根据rulesMap找到规则
-            auto it = rulesMap.find(currentTriple.predicate);
-            if (it != rulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = rules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = currentTriple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = currentTriple.object;
-                    }
-
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings);
-
-                    // 将新事实加入队列
-                    {
-                        std::lock_guard<std::mutex> lock(queueMutex);
-                        for (const auto& fact : inferredFacts) {
-                            // std::lock_guard<std::mutex> storeLock(storeMutex);
-                            if (store.getNodeByTriple(fact) == nullptr) {
-                                // store.addTriple(fact);
-                                newFactQueue.push(fact);
-                            }
-                        }
+        stratum.rules.push_back(i);
+        stratum.recursive = stratum.recursive || isRecursive;
+        if (isRecursive) {
+            recursiveRules.push_back(rule);
+        } else {
+            nonrecursiveRules.push_back(rule);
+        }
+    }
+    // 按拓扑序计算 level，被依赖的分量已先算出
+    for (size_t i = 0; i < componentCount; i++) {
+        for (size_t rule : components[i].rules) {
+            for (const auto& pattern : rules[rule].body) {
+                for (size_t source : sourcesOf(pattern)) {
+                    if (order(source) != i) {
+                        components[i].level = std::max(components[i].level, components[order(source)].level + 1);
                     }
                 }
             }
+        }
+    }
+    // 按 level 稳定排序后仍是拓扑序，同一 level 的分层相邻
+    std::stable_sort(components.begin(), components.end(),
+                     [](const Stratum& a, const Stratum& b) { return a.level < b.level; });
+    strata = std::move(components);
+    for (size_t i = 0; i < strata.size(); i++) {
+        for (size_t rule : strata[i].rules) {
+            ruleStratum[rule] = i;
+        }
+    }
+}
 
-            // 任务完成，减少活动任务计数
-            activeTaskCount--;
-        });
-
-        // 确保任务完成
-        future.get();
-    }
-
-    */
-    /////////////////////////////////////
-
-    std::atomic<bool> done(false);
-    std::condition_variable cv;
-    const auto threadCount = std::thread::hardware_concurrency();
-    std::vector<std::thread> workers;
-
-    // 工作线程
-    auto worker = [&]() {
-        while (true) {
-            // reasonCount++;
-            Triple currentTriple("", "", "");
-            {
-                std::unique_lock<std::mutex> lock(queueMutex);
-                cv.wait(lock, [&] { return !newFactQueue.empty() || done; });
-                if (done && newFactQueue.empty()) break;
-                currentTriple = newFactQueue.front();
-                newFactQueue.pop();
-                activeTaskCount++; // 增加活动任务计数
-                // reasonCount++; // 统计推理次数
-            }
+void DatalogEngine::reason() {
+    // update: 不再逐个事实出队、以单个事实为触发重新 join，改为按轮进行的半朴素求值。
+    // 每轮把上一轮新推出的事实（增量关系）加入事实库并建成 Trie，对每个可能匹配它的 (规则, 模式) 做一次 join，
+    // 新推出且不在事实库中的事实构成下一轮的增量关系，没有新事实时到达不动点
+    // update: 按分层的拓扑序求值，只有递归分层需要迭代；同一 level 的分层互不依赖，并行求值
+    // update: join 交给工作窃取的 TaskScheduler，任务为 (规则, 增量模式, 增量关系的一批)，
+    // 每轮等待任务组完成即为该轮结束，不再由主线程轮询全局队列
+    // update: 工作线程推出事实后立即在无锁集合 derived 中查重，只有首先插入的线程把它交给下一轮
+    // 写事实库时持有事实库的独占锁，join 和查重时持有共享锁，同一把锁也保护其他线程通过 StoreVersion 进行的查询。
+    // 整个推理作为一个批次发布
+    planJoins(); // 按当前的谓语统计信息重新选择变量顺序，之后各线程只读
+    countsValid = false; // 半朴素求值不统计推导次数
+    store.beginBatch();
+
+    TaskScheduler scheduler;
+    ConcurrentTripleSet derived;
+    ReasonStats stats;
+    size_t recursiveCount = 0;
+    for (size_t begin = 0, end = 0; begin < strata.size(); begin = end) {
+        while (end < strata.size() && strata[end].level == strata[begin].level) {
+            recursiveCount += strata[end].recursive;
+            end++;
+        }
+        // 各分层的任务提交到同一个调度器，由它在工作线程间平衡
+        std::vector<std::future<void>> futures;
+        for (size_t i = begin + 1; i < end; i++) {
+            futures.push_back(std::async(std::launch::async, [&, i]() { evaluateStratum(strata[i], scheduler, derived, stats); }));
+        }
+        evaluateStratum(strata[begin], scheduler, derived, stats);
+        for (auto& future : futures) {
+            future.get();
+        }
+    }
+    store.publishBatch();
 
-            // 将当前事实加入事实库
-            {
-                std::lock_guard<std::mutex> lock(storeMutex);
-                if (store.getNodeByTriple(currentTriple) == nullptr) {
-                    store.addTriple(currentTriple);
-                    // newFactAdded = true;
-                    // reasonCount++;
-                }
-                reasonCount++;
-            }
 
-            // 处理 currentTriple，推理新事实并加锁入队
-            // 根据rulesMap找到规则
-            auto it = rulesMap.find(currentTriple.predicate);
-            if (it != rulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = rules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = currentTriple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = currentTriple.object;
-                    }
+    // 输出推理完成后的事实库大小
+    std::cout << "Total triples in store:           " << store.getAllTriples().size() << std::endl;
+    // 输出总共推理的次数
+    std::cout << "Total reasoning count:            " << stats.derivations.load() << std::endl;
+    std::cout << "Strata (recursive):               " << strata.size() << " (" << recursiveCount << ")" << std::endl;
+    std::cout << "Semi-naive iterations:            " << stats.iterations.load() << std::endl;
+    std::cout << "Duplicate derivations avoided:    " << stats.skipped.load() << std::endl;
+}
 
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings);
-                    // reasonCount++;
-
-                    // 将新事实加入队列
-                    {
-                        std::lock_guard<std::mutex> lock(queueMutex);
-                        for (const auto& fact : inferredFacts) {
-                            // std::lock_guard<std::mutex> storeLock(storeMutex);
-                            if (store.getNodeByTriple(fact) == nullptr) {
-                                // store.addTriple(fact);
-                                newFactQueue.push(fact);
-                                // reasonCount++;
-                            }
-                        }
-                    }
-                }
+void DatalogEngine::evaluateStratum(const Stratum& stratum, TaskScheduler& scheduler, ConcurrentTripleSet& derived,
+                                    ReasonStats& stats) {
+    // 两个增量关系轮流使用：current 为本轮 join 读取的，next 收集本轮新推出的事实
+    DeltaRelation firstDelta(store), secondDelta(store);
+    DeltaRelation* current = &firstDelta;
+    DeltaRelation* next = &secondDelta;
+    std::vector<std::vector<IdTriple>> outputs;
+    // outputs 中已经是去重后的新事实
+    auto collect = [&]() {
+        for (const auto& output : outputs) {
+            for (const auto& fact : output) {
+                next->insert(fact);
             }
-
-            // 任务完成，减少活动任务计数
-            activeTaskCount--;
         }
     };
 
-    // 启动线程池
-    workers.reserve(threadCount);
-    for (int i = 0; i < threadCount; ++i) {
-        workers.emplace_back(worker);
+    // 第一轮：低层的事实都已推出，完整执行本层的每条规则
+    std::vector<JoinTask> tasks;
+    for (size_t rule : stratum.rules) {
+        tasks.push_back({rule, NO_TRIGGER, 0});
     }
+    runJoins(scheduler, tasks, nullptr, derived, outputs, stats);
+    collect();
 
-    // 主线程不断唤醒工作线程
-    while (true) {
+    while (!next->empty()) {
+        std::swap(current, next);
+        next->clear();
         {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            if (newFactQueue.empty() && activeTaskCount == 0) {
-                break;
+            auto lock = store.lockExclusive();
+            for (const auto& fact : current->getTriples()) {
+                store.addTriple(fact);
             }
         }
-        cv.notify_all();
-        std::this_thread::yield();
-    }
-
-    // 结束所有线程
-    done = true;
-    cv.notify_all();
-    for (auto& t : workers) t.join();
+        // 非递归分层的规则体不读本层推出的谓语，一轮即完成
+        if (!stratum.recursive) {
+            break;
+        }
+        stats.iterations++;
 
+        // 各批的 Trie 并行构建
+        size_t batchCount = current->partition();
+        TaskScheduler::TaskGroup building;
+        for (size_t batch = 0; batch < batchCount; batch++) {
+            scheduler.submit(building, [current, batch](size_t) { current->buildBatch(batch); });
+        }
+        scheduler.wait(building);
+
+        // 只有本层规则中谓语出现在这一批中的模式（以及谓语为变量的模式）需要以这一批为增量模式
+        tasks.clear();
+        for (size_t batch = 0; batch < batchCount; batch++) {
+            std::set<std::pair<size_t, size_t>> rulePatterns;
+            for (TermId predicate : current->getPredicates(batch)) {
+                for (const auto& rulePair : triggersOf(rulesMap, predicate)) {
+                    if (&strata[ruleStratum[rulePair.first]] == &stratum) {
+                        rulePatterns.insert(rulePair);
+                    }
+                }
+            }
+            for (const auto& rulePair : rulePatterns) {
+                tasks.push_back({rulePair.first, rulePair.second, batch});
+            }
+        }
+        runJoins(scheduler, tasks, current, derived, outputs, stats);
+        collect();
+    }
+}
 
-    // 输出推理完成后的事实库大小
-    std::cout << "Total triples in store:           " << store.getAllTriples().size() << std::endl;
-    // 输出总共推理的次数
-    std::cout << "Total reasoning count:            " << reasonCount.load() << std::endl;
+void DatalogEngine::runJoins(TaskScheduler& scheduler, const std::vector<JoinTask>& tasks, const DeltaRelation* delta,
+                             ConcurrentTripleSet& derived, std::vector<std::vector<IdTriple>>& outputs,
+                             ReasonStats& stats) {
+    // 推出的事实先写入执行任务的工作线程自己的缓冲区，不需要加锁
+    outputs.assign(scheduler.threadCount(), std::vector<IdTriple>());
+    // update: 每个任务再按最外层变量的键分成多段，一条规则的大 join 也能分到所有工作线程上
+    size_t morselCount = scheduler.threadCount() > 1 ? scheduler.threadCount() * MORSELS_PER_THREAD : 1;
+    TaskScheduler::TaskGroup group;
+    for (const JoinTask& task : tasks) {
+        const IdRule& rule = rules[task.rule];
+        const RulePlan& plan = rulePlans.at(&rule);
+        const TriggerPlan& triggerPlan = task.pattern == NO_TRIGGER ? plan.triggers[plan.body.size() + 1]
+                                                                    : plan.deltas[task.pattern];
+        std::vector<Morsel> morsels;
+        {
+            auto lock = store.lockShared();
+            morsels = splitFirstLevel(triggerPlan, delta, task.batch, morselCount);
+        }
+        for (const Morsel& morsel : morsels) {
+            scheduler.submit(group, [this, &task, &rule, delta, &derived, &outputs, &stats, morsel](size_t worker) {
+                std::vector<IdTriple>& output = outputs[worker];
+                size_t begin = output.size();
+                auto lock = store.lockShared();
+                if (task.pattern == NO_TRIGGER) {
+                    leapfrogTriejoin(rule, output, NO_TRIGGER, IdTriple(), morsel);
+                } else {
+                    stats.skipped += leapfrogTriejoinDelta(rule, task.pattern, *delta, task.batch, output, morsel);
+                }
+                // 只保留本线程赢得插入的新事实，每个新事实恰好由一个线程交给下一轮
+                size_t kept = begin;
+                for (size_t i = begin; i < output.size(); i++) {
+                    if (!store.contains(output[i]) && derived.insert(output[i])) {
+                        output[kept++] = output[i];
+                    }
+                }
+                stats.derivations += output.size() - begin;
+                output.resize(kept);
+            });
+        }
+    }
+    scheduler.wait(group);
 }
 
 void DatalogEngine::reasonNaive() {
+    planJoins();
+    store.beginBatch();
 
-    std::queue<Triple> newFactQueue; // 存储新产生的事实，出队时触发对应规则的应用，并存到事实库中
+    std::vector<IdTriple> newFactQueue; // 存储新产生的事实，下一批中触发对应规则的应用，并存到事实库中
 
-    std::set<Triple> newFactsSet; // 用于去重新事实
+    std::set<IdTriple> newFactsSet; // 用于去重新事实
     // 先进行第一轮推理，初始时没有新事实，遍历规则逐条应用
     // int ruleId = 0;
     for (const auto& rule : recursiveRules) {
-        std::vector<Triple> newFacts;
-        std::map<std::string, std::string> bindings;
-        leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, newFacts, bindings);
+        std::vector<IdTriple> newFacts;
+        leapfrogTriejoin(rule, newFacts);
         // printf("New facts derived from rule (%s): %zu\n", rule.name.c_str(), newFacts.size());
         // for(const auto& newFact : newFacts) {
         //     printf("(%s, %s, %s)\n", newFact.subject.c_str(), newFact.predicate.c_str(), newFact.object.c_str());
         // }
         for (const auto& triple : newFacts) {
-            if (store.getNodeByTriple(triple) == nullptr) {
+            if (!store.contains(triple)) {
                 // store.addTriple(triple);
                 if(newFactsSet.find(triple) == newFactsSet.end()) {
                     newFactsSet.insert(triple);
-                    newFactQueue.push(triple);
+                    newFactQueue.push_back(triple);
                     // printf("New fact added: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
                 }
                 if(recursiveNum.find(triple) == recursiveNum.end()) {
@@ -346,19 +413,18 @@ void DatalogEngine::reasonNaive() {
     }
 
     for (const auto& rule : nonrecursiveRules) {
-        std::vector<Triple> newFacts;
-        std::map<std::string, std::string> bindings;
-        leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, newFacts, bindings);
+        std::vector<IdTriple> newFacts;
+        leapfrogTriejoin(rule, newFacts);
         // printf("New facts derived from rule (%s): %zu\n", rule.name.c_str(), newFacts.size());
         // for(const auto& newFact : newFacts) {
         //     printf("(%s, %s, %s)\n", newFact.subject.c_str(), newFact.predicate.c_str(), newFact.object.c_str());
         // }
         for (const auto& triple : newFacts) {
-            if (store.getNodeByTriple(triple) == nullptr) {
+            if (!store.contains(triple)) {
                 // store.addTriple(triple);
                 if(newFactsSet.find(triple) == newFactsSet.end()) {
                     newFactsSet.insert(triple);
-                    newFactQueue.push(triple);
+                    newFactQueue.push_back(triple);
                     // printf("New fact added: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
                 }
                 if(nonrecursiveNum.find(triple) == nonrecursiveNum.end()) {
@@ -372,107 +438,60 @@ void DatalogEngine::reasonNaive() {
     }
 
 
-    while (true) {
-        // reasonCount++
-        Triple currentTriple("", "", "");
-        if (newFactQueue.empty()) break;
-        currentTriple = newFactQueue.front();
-        newFactQueue.pop();
-
-        // 将当前事实加入事实库
-        if (store.getNodeByTriple(currentTriple) == nullptr) {
-            store.addTriple(currentTriple);
-            // newFactAdded = true;
-            // reasonCount++;
-        }
-
-        // 处理 currentTriple，推理新事实并加锁入队
-        // 根据rulesMap找到规则
-        auto it = recursiveRulesMap.find(currentTriple.predicate);
-        if (it != recursiveRulesMap.end()) {
-            for (const auto& rulePair : it->second) {
-                size_t ruleIdx = rulePair.first;
-                size_t patternIdx = rulePair.second;
-                const Rule& rule = recursiveRules[ruleIdx];
-                const Triple& pattern = rule.body[patternIdx];
-                // printf("Applying rule: %s\n", rule.name.c_str());
-                // printf("Pattern: (%s, %s, %s)\n", pattern.subject.c_str(), pattern.predicate.c_str(), pattern.object.c_str());
-                // // 绑定变量
-                std::map<std::string, std::string> bindings;
-                if (isVariable(pattern.subject)) {
-                    bindings[pattern.subject] = currentTriple.subject;
-                }
-                if (isVariable(pattern.object)) {
-                    bindings[pattern.object] = currentTriple.object;
-                }
+    // update: 不再逐个事实出队、以单个事实为触发 join，队列中现有的事实作为一批加入事实库并建成增量关系，
+    // 每个 (规则, 模式) 对整批只 join 一次，期间推出的新事实组成下一批
+    DeltaRelation delta(store);
+    std::vector<IdTriple> currentFacts;
+    while (!newFactQueue.empty()) {
+        currentFacts.swap(newFactQueue);
+        newFactQueue.clear();
 
-                // 调用leapfrogTriejoin推理新事实
-                std::vector<Triple> inferredFacts;
-                leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings);
-
-                for (const auto& fact : inferredFacts) {
-                    // std::lock_guard<std::mutex> storeLock(storeMutex);
-                    if (store.getNodeByTriple(fact) == nullptr) {
-                        // store.addTriple(fact);
-                        if(newFactsSet.find(fact) == newFactsSet.end()) {
-                            newFactsSet.insert(fact);
-                            newFactQueue.push(fact);
-                            // printf("New fact added: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
-                        }
-                    }
-                    // reasonCount++;
-                    if(recursiveNum.find(fact) == recursiveNum.end()) {
-                        recursiveNum[fact] = 1;
-                    } else {
-                        recursiveNum[fact]++;
-                    }
+        // 将当前这批事实加入事实库
+        {
+            auto lock = store.lockExclusive();
+            for (const auto& fact : currentFacts) {
+                store.addTriple(fact);
+            }
+        }
+        delta.assign(currentFacts);
+
+        // 以这批事实触发规则，推理新事实并入队
+        std::vector<IdTriple> inferredFacts;
+        joinTriggers(recursiveRules, recursiveRulesMap, delta, inferredFacts);
+        for (const auto& fact : inferredFacts) {
+            if (!store.contains(fact)) {
+                if(newFactsSet.find(fact) == newFactsSet.end()) {
+                    newFactsSet.insert(fact);
+                    newFactQueue.push_back(fact);
                 }
             }
+            if(recursiveNum.find(fact) == recursiveNum.end()) {
+                recursiveNum[fact] = 1;
+            } else {
+                recursiveNum[fact]++;
+            }
         }
 
-        it = nonrecursiveRulesMap.find(currentTriple.predicate);
-        if (it != nonrecursiveRulesMap.end()) {
-            for (const auto& rulePair : it->second) {
-                size_t ruleIdx = rulePair.first;
-                size_t patternIdx = rulePair.second;
-                const Rule& rule = nonrecursiveRules[ruleIdx];
-                const Triple& pattern = rule.body[patternIdx];
-                // printf("Applying rule: %s\n", rule.name.c_str());
-                // printf("Pattern: (%s, %s, %s)\n", pattern.subject.c_str(), pattern.predicate.c_str(), pattern.object.c_str());
-                // // 绑定变量
-                std::map<std::string, std::string> bindings;
-                if (isVariable(pattern.subject)) {
-                    bindings[pattern.subject] = currentTriple.subject;
-                }
-                if (isVariable(pattern.object)) {
-                    bindings[pattern.object] = currentTriple.object;
+        inferredFacts.clear();
+        joinTriggers(nonrecursiveRules, nonrecursiveRulesMap, delta, inferredFacts);
+        for (const auto& fact : inferredFacts) {
+            if (!store.contains(fact)) {
+                if(newFactsSet.find(fact) == newFactsSet.end()) {
+                    newFactsSet.insert(fact);
+                    newFactQueue.push_back(fact);
                 }
-
-                // 调用leapfrogTriejoin推理新事实
-                std::vector<Triple> inferredFacts;
-                leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings);
-
-                for (const auto& fact : inferredFacts) {
-                    // std::lock_guard<std::mutex> storeLock(storeMutex);
-                    if (store.getNodeByTriple(fact) == nullptr) {
-                        // store.addTriple(fact);
-                        if(newFactsSet.find(fact) == newFactsSet.end()) {
-                            newFactsSet.insert(fact);
-                            newFactQueue.push(fact);
-                            // printf("New fact added: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
-                        }
-                        // reasonCount++;
-                        if(nonrecursiveNum.find(fact) == nonrecursiveNum.end()) {
-                            nonrecursiveNum[fact] = 1;
-                        } else {
-                            nonrecursiveNum[fact]++;
-                        }
-                    }
+                if(nonrecursiveNum.find(fact) == nonrecursiveNum.end()) {
+                    nonrecursiveNum[fact] = 1;
+                } else {
+                    nonrecursiveNum[fact]++;
                 }
             }
         }
     }
 
+    store.publishBatch();
+    countsValid = true;
+
     // 输出推理完成后的事实库大小
     std::cout << "Total triples in store:           " << store.getAllTriples().size() << std::endl;
     // auto it = recursiveNum.begin();
@@ -489,9 +508,23 @@ void DatalogEngine::reasonNaive() {
 }
 
 
-void DatalogEngine::leapfrogDRed(std::vector<Triple>& deletedFacts, std::vector<Triple>& insertedFacts) {
+void DatalogEngine::leapfrogDRed(std::vector<Triple>& deletedTriples, std::vector<Triple>& insertedTriples) {
+    if (wal != nullptr && wal->append(deletedTriples, insertedTriples, MaintenancePath::DRed) == 0) {
+        printf("Failed to write update batch to log\n");
+        return;
+    }
+    // 本路径不维护推导计数，之后的计数不再与事实库一致
+    countsValid = false;
+    planJoins();
+    // 过删除和重新推导的中间状态对并发查询不可见，整批修改一起发布
+    store.beginBatch();
+    std::vector<IdTriple> deletedFacts = encodeFacts(deletedTriples);
+    std::vector<IdTriple> insertedFacts = encodeFacts(insertedTriples);
+    // 先从显式事实中删除本批被删的事实，one-step redrive 时仍是显式事实的才是未被删除的显式事实
+    deleteExplicitFacts(deletedFacts);
+
     // overdelete
-    std::vector<Triple> overdeletedFacts;
+    std::vector<IdTriple> overdeletedFacts;
     overdeleteDRed(overdeletedFacts, deletedFacts);
     printf("Overdeleted facts: %zu\n", overdeletedFacts.size());
     // for(const auto& fact: overdeletedFacts) {
@@ -499,34 +532,25 @@ void DatalogEngine::leapfrogDRed(std::vector<Triple>& deletedFacts, std::vector<
     // }
 
     // one-step redrive
-    std::vector<Triple> redrivedFacts;
+    std::vector<IdTriple> redrivedFacts;
     for(auto& fact: overdeletedFacts) {
-        if(originalStore.getNodeByTriple(fact) != nullptr) {
+        if(isExplicit(fact)) {
             redrivedFacts.push_back(fact);
             continue;
         }
-        for(auto rule : rules) {
+        for(const auto& rule : rules) {
             if(rule.head.predicate != fact.predicate) {
                 continue; // 只处理谓语匹配的规则
             }
-            std::map<std::string, std::string> bindings;
-            // 绑定变量
-            if (isVariable(rule.head.subject)) {
-                bindings[rule.head.subject] = fact.subject;
-            }
-            if (isVariable(rule.head.object)) {
-                bindings[rule.head.object] = fact.object;
-            }
-
-            // 调用leapfrogTriejoin推理新事实
-            std::vector<Triple> newFacts;
-            leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, newFacts, bindings);
+            // 以规则头绑定变量，调用leapfrogTriejoin推理新事实
+            std::vector<IdTriple> newFacts;
+            leapfrogTriejoin(rule, newFacts, HEAD_TRIGGER, fact);
             // printf("New facts derived from rule (%s): %zu\n", rule.name.c_str(), newFacts.size());
             // for(const auto& newFact : newFacts) {
             //     printf("(%s, %s, %s)\n", newFact.subject.c_str(), newFact.predicate.c_str(), newFact.object.c_str());
             // }
             if(!newFacts.empty()) {
-                if (store.getNodeByTriple(fact) == nullptr) {
+                if (!store.contains(fact)) {
                     redrivedFacts.push_back(fact);
                     break;
                 }
@@ -540,7 +564,7 @@ void DatalogEngine::leapfrogDRed(std::vector<Triple>& deletedFacts, std::vector<
     //     printf("(%s, %s, %s)\n", fact.subject.c_str(), fact.predicate.c_str(), fact.object.c_str());
     // }
     // for(const auto& fact: redrivedFacts) {
-    //     if (store.getNodeByTriple(fact) == nullptr) {
+    //     if (!store.contains(fact)) {
     //         store.addTriple(fact);
     //     }
     // }
@@ -548,35 +572,32 @@ void DatalogEngine::leapfrogDRed(std::vector<Triple>& deletedFacts, std::vector<
     // insert
     insertDRed(insertedFacts, redrivedFacts);
 
-    for(const auto& fact: deletedFacts) {
-        originalStore.deleteTriple(fact);
-    }
-    
-    for(const auto& fact: insertedFacts) {
-        originalStore.addTriple(fact);
-    }
+    insertExplicitFacts(insertedFacts);
 
+    store.publishBatch();
+    rebaseExplicitFacts();
     printf("Total triples in store: %zu\n", store.getAllTriples().size());
 
 }
 
-void DatalogEngine::overdeleteDRed(std::vector<Triple> &overdeletedFacts, std::vector<Triple> deletedFacts) {
+void DatalogEngine::overdeleteDRed(std::vector<IdTriple> &overdeletedFacts, std::vector<IdTriple> deletedFacts) {
     // D overdeletedFacts
     // N_D inferredFactsSet
     // delta_D deletedFacts
     // 对每个删除的事实，检查是否有规则可以应用
-    std::set<Triple> overdeletedFactsSet;
-    std::set<Triple> inferredFactsSet;
+    std::set<IdTriple> overdeletedFactsSet;
+    std::set<IdTriple> inferredFactsSet;
+    DeltaRelation delta(store);
     
     // N_D = E-
     for(auto& fact: deletedFacts) {
-        if (store.getNodeByTriple(fact) != nullptr) {
+        if (store.contains(fact)) {
             inferredFactsSet.insert(fact);
         }
     }
 
     while(true) {
-        std::vector<Triple> deltaD;
+        std::vector<IdTriple> deltaD;
         // delta_D = N_D - D
         for(const auto& triple: inferredFactsSet) {
             if(overdeletedFactsSet.find(triple) == overdeletedFactsSet.end()) {
@@ -589,40 +610,21 @@ void DatalogEngine::overdeleteDRed(std::vector<Triple> &overdeletedFacts, std::v
 
         inferredFactsSet.clear();
         // N_D = PI[I - D : delta_D]
-        for (const auto& triple : deltaD) {
-            // 根据谓语查找规则
-            auto it = rulesMap.find(triple.predicate);
-            if (it != rulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = rules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // printf("Pattern: (%s, %s, %s)\n", pattern.subject.c_str(), pattern.predicate.c_str(), pattern.object.c_str());
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = triple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = triple.object;
-                    }
-
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings); 
-                    for(const auto& fact : inferredFacts) {
-                        if (store.getNodeByTriple(fact) != nullptr) {
-                            inferredFactsSet.insert(fact);
-                        }
-                    }
-                }
+        // update: delta_D 整批建成增量关系，每个 (规则, 模式) 只 join 一次（delta_D 此时仍在事实库中）
+        delta.assign(deltaD);
+        std::vector<IdTriple> inferredFacts;
+        joinTriggers(rules, rulesMap, delta, inferredFacts);
+        for(const auto& fact : inferredFacts) {
+            if (store.contains(fact)) {
+                inferredFactsSet.insert(fact);
             }
         }
         // I -= delta_D
-        for(const auto& fact: deltaD) {
-            store.deleteTriple(fact);
+        {
+            auto lock = store.lockExclusive();
+            for(const auto& fact: deltaD) {
+                store.deleteTriple(fact);
+            }
         }
         // D = D U delta_D
         for (const auto& fact : deltaD) {
@@ -633,28 +635,29 @@ void DatalogEngine::overdeleteDRed(std::vector<Triple> &overdeletedFacts, std::v
 
     for(const auto& fact : overdeletedFactsSet) {
         // 将overdeletedFactsSet中的事实加入到overdeletedFacts中
-        if (store.getNodeByTriple(fact) == nullptr) {
+        if (!store.contains(fact)) {
             overdeletedFacts.push_back(fact);
         }
     }
     
 }
 
-void DatalogEngine::insertDRed(std::vector<Triple> newFacts, std::vector<Triple> redrivedFacts) {
+void DatalogEngine::insertDRed(std::vector<IdTriple> newFacts, std::vector<IdTriple> redrivedFacts) {
     // N_A = R + E+
-    std::vector<Triple> allInsertedFacts;
-    std::vector<Triple> insertedFacts;
+    std::vector<IdTriple> allInsertedFacts;
+    std::vector<IdTriple> insertedFacts;
     for(const auto& triple : newFacts) {
         insertedFacts.push_back(triple);
     }
     for(const auto& triple : redrivedFacts) {
         insertedFacts.push_back(triple);
     }
+    DeltaRelation delta(store);
     while(true) {
-        std::vector<Triple> deltaA;
+        std::vector<IdTriple> deltaA;
         // delta_A = N_A - (I - D + A)
         for(const auto& triple: insertedFacts) {
-            if (store.getNodeByTriple(triple) == nullptr) {
+            if (!store.contains(triple)) {
                 deltaA.push_back(triple);
             }
         }
@@ -663,47 +666,28 @@ void DatalogEngine::insertDRed(std::vector<Triple> newFacts, std::vector<Triple>
             break;
         printf("Delta A size: %zu\n", deltaA.size());
         // A = A U delta_A
-        for (const auto& fact : deltaA) {
-            if(store.getNodeByTriple(fact) == nullptr) {
-                store.addTriple(fact);
-                allInsertedFacts.push_back(fact);
+        {
+            auto lock = store.lockExclusive();
+            for (const auto& fact : deltaA) {
+                if(store.addTriple(fact)) {
+                    allInsertedFacts.push_back(fact);
+                }
             }
         }
-        std::set<Triple> inferredFactsSet;
-        for (const auto& triple : deltaA) {
-            // 根据谓语查找规则
-            auto it = rulesMap.find(triple.predicate);
-            if (it != rulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = rules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = triple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = triple.object;
-                    }
-
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings); 
-                    for(const auto& fact : inferredFacts) {
-                        if (store.getNodeByTriple(fact) == nullptr) {
-                            inferredFactsSet.insert(fact);
-                        }
-                    }
-                }
+        // update: delta_A 整批建成增量关系，每个 (规则, 模式) 只 join 一次
+        delta.assign(deltaA);
+        std::vector<IdTriple> inferredFacts;
+        joinTriggers(rules, rulesMap, delta, inferredFacts);
+        std::set<IdTriple> inferredFactsSet;
+        for(const auto& fact : inferredFacts) {
+            if (!store.contains(fact)) {
+                inferredFactsSet.insert(fact);
             }
         }
         insertedFacts.clear();
         for(auto& fact : inferredFactsSet) {
             // 将推理出的事实加入到insertedFacts中
-            if (store.getNodeByTriple(fact) == nullptr) {
+            if (!store.contains(fact)) {
                 insertedFacts.push_back(fact);
             }
         }
@@ -716,9 +700,21 @@ void DatalogEngine::insertDRed(std::vector<Triple> newFacts, std::vector<Triple>
 
 }
 
-void DatalogEngine::leapfrogDRedCounting(std::vector<Triple>& deletedFacts, std::vector<Triple>& insertedFacts) {
+void DatalogEngine::leapfrogDRedCounting(std::vector<Triple>& deletedTriples, std::vector<Triple>& insertedTriples) {
+    if (wal != nullptr && wal->append(deletedTriples, insertedTriples, MaintenancePath::CountingDRed) == 0) {
+        printf("Failed to write update batch to log\n");
+        return;
+    }
+    planJoins();
+    // 过删除和重新推导的中间状态对并发查询不可见，整批修改一起发布
+    store.beginBatch();
+    std::vector<IdTriple> deletedFacts = encodeFacts(deletedTriples);
+    std::vector<IdTriple> insertedFacts = encodeFacts(insertedTriples);
+    // 先从显式事实中删除本批被删的事实，one-step redrive 时仍是显式事实的才是未被删除的显式事实
+    deleteExplicitFacts(deletedFacts);
+
     // overdelete
-    std::vector<Triple> overdeletedFacts;
+    std::vector<IdTriple> overdeletedFacts;
     overdeleteDRedCounting(overdeletedFacts, deletedFacts);
     printf("Overdeleted facts: %zu\n", overdeletedFacts.size());
     // for(const auto& fact: overdeletedFacts) {
@@ -733,7 +729,7 @@ void DatalogEngine::leapfrogDRedCounting(std::vector<Triple>& deletedFacts, std:
     //     printf("(%s, %s, %s) : %d\n", fact.first.subject.c_str(), fact.first.predicate.c_str(), fact.first.object.c_str(), fact.second);
     // }
     // one-step redrive
-    std::vector<Triple> redrivedFacts;
+    std::vector<IdTriple> redrivedFacts;
     for(auto& fact: overdeletedFacts) {
         if(recursiveNum.find(fact) != recursiveNum.end() && recursiveNum[fact] > 0) {
             redrivedFacts.push_back(fact);
@@ -746,7 +742,7 @@ void DatalogEngine::leapfrogDRedCounting(std::vector<Triple>& deletedFacts, std:
     //     printf("(%s, %s, %s)\n", fact.subject.c_str(), fact.predicate.c_str(), fact.object.c_str());
     // }
     // for(const auto& fact: redrivedFacts) {
-    //     if (store.getNodeByTriple(fact) == nullptr) {
+    //     if (!store.contains(fact)) {
     //         store.addTriple(fact);
     //     }
     // }
@@ -754,36 +750,33 @@ void DatalogEngine::leapfrogDRedCounting(std::vector<Triple>& deletedFacts, std:
     // insert
     insertDRedCounting(insertedFacts, redrivedFacts);
 
-    for(const auto& fact: deletedFacts) {
-        originalStore.deleteTriple(fact);
-    }
-    
-    for(const auto& fact: insertedFacts) {
-        originalStore.addTriple(fact);
-    }
+    insertExplicitFacts(insertedFacts);
     
+    store.publishBatch();
+    rebaseExplicitFacts();
     printf("Total triples in store: %zu\n", store.getAllTriples().size());
 
 }
 
-void DatalogEngine::overdeleteDRedCounting(std::vector<Triple> &overdeletedFacts, std::vector<Triple> deletedFacts) {
+void DatalogEngine::overdeleteDRedCounting(std::vector<IdTriple> &overdeletedFacts, std::vector<IdTriple> deletedFacts) {
     // D overdeletedFacts
     // N_D inferredFactsSet
     // delta_D deletedFacts
     // 对每个删除的事实，检查是否有规则可以应用
-    std::multiset<Triple> overdeletedFactsSet;
-    std::set<Triple> inferredFactsSet;
+    std::multiset<IdTriple> overdeletedFactsSet;
+    std::set<IdTriple> inferredFactsSet;
+    DeltaRelation delta(store);
     
     // N_D = E-
     for(auto& fact: deletedFacts) {
-        if (store.getNodeByTriple(fact) != nullptr) {
+        if (store.contains(fact)) {
             inferredFactsSet.insert(fact);
             nonrecursiveNum[fact]--;
         }
     }
 
     while(true) {
-        std::vector<Triple> deltaD;
+        std::vector<IdTriple> deltaD;
         // delta_D = N_D - D
         for(const auto& triple: inferredFactsSet) {
             if(overdeletedFactsSet.find(triple) == overdeletedFactsSet.end() && nonrecursiveNum[triple] == 0) {
@@ -796,77 +789,33 @@ void DatalogEngine::overdeleteDRedCounting(std::vector<Triple> &overdeletedFacts
 
         inferredFactsSet.clear();
         // N_D = PI[I - D : delta_D]
-        // printf("delta D: %zu\n", deltaD.size());
-        for (const auto& triple : deltaD) {
-            // printf("Processing triple: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
-            // 根据谓语查找规则
-            // nonrecursive
-            auto it = nonrecursiveRulesMap.find(triple.predicate);
-            if (it != nonrecursiveRulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = nonrecursiveRules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // printf("Pattern: (%s, %s, %s)\n", pattern.subject.c_str(), pattern.predicate.c_str(), pattern.object.c_str());
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = triple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = triple.object;
-                    }
-
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings); 
-                    for(const auto& fact : inferredFacts) {
-                        nonrecursiveNum[fact]--;
-                        if (store.getNodeByTriple(fact) != nullptr) {
-                            inferredFactsSet.insert(fact);
-                        }
-                    }
-                }
+        // update: 与 overdeleteDRed 相同，delta_D 整批建成增量关系，每个 (规则, 模式) 只 join 一次，
+        // 每个用到 delta_D 的推导恰好扣减一次计数
+        delta.assign(deltaD);
+        std::vector<IdTriple> inferredFacts;
+        // nonrecursive
+        joinTriggers(nonrecursiveRules, nonrecursiveRulesMap, delta, inferredFacts);
+        for(const auto& fact : inferredFacts) {
+            nonrecursiveNum[fact]--;
+            if (store.contains(fact)) {
+                inferredFactsSet.insert(fact);
             }
-
-            // recursive
-            it = recursiveRulesMap.find(triple.predicate);
-            if (it != recursiveRulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = recursiveRules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // printf("Pattern: (%s, %s, %s)\n", pattern.subject.c_str(), pattern.predicate.c_str(), pattern.object.c_str());
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = triple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = triple.object;
-                    }
-
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings);
-                    // printf("Inferred facts size: %zu\n", inferredFacts.size()); 
-                    for(const auto& fact : inferredFacts) {
-                        // printf("Inferred fact: (%s, %s, %s)\n", fact.subject.c_str(), fact.predicate.c_str(), fact.object.c_str());
-                        recursiveNum[fact]--;
-                        if (store.getNodeByTriple(fact) != nullptr) {
-                            inferredFactsSet.insert(fact);
-                        }
-                    }
-                }
+        }
+        // recursive
+        inferredFacts.clear();
+        joinTriggers(recursiveRules, recursiveRulesMap, delta, inferredFacts);
+        for(const auto& fact : inferredFacts) {
+            recursiveNum[fact]--;
+            if (store.contains(fact)) {
+                inferredFactsSet.insert(fact);
             }
         }
         // I -= delta_D
-        for(const auto& fact: deltaD) {
-            store.deleteTriple(fact);
+        {
+            auto lock = store.lockExclusive();
+            for(const auto& fact: deltaD) {
+                store.deleteTriple(fact);
+            }
         }
         // D = D U delta_D
         for (const auto& fact : deltaD) {
@@ -877,17 +826,17 @@ void DatalogEngine::overdeleteDRedCounting(std::vector<Triple> &overdeletedFacts
 
     for(const auto& fact : overdeletedFactsSet) {
         // 将overdeletedFactsSet中的事实加入到overdeletedFacts中
-        if (store.getNodeByTriple(fact) == nullptr) {
+        if (!store.contains(fact)) {
             overdeletedFacts.push_back(fact);
         }
     }
     
 }
 
-void DatalogEngine::insertDRedCounting(std::vector<Triple> newFacts, std::vector<Triple> redrivedFacts) {
+void DatalogEngine::insertDRedCounting(std::vector<IdTriple> newFacts, std::vector<IdTriple> redrivedFacts) {
     // N_A = R + E+
     for(auto& fact : newFacts) {
-        if (store.getNodeByTriple(fact) == nullptr) {
+        if (!store.contains(fact)) {
             if(nonrecursiveNum.find(fact) == nonrecursiveNum.end()) {
                 nonrecursiveNum[fact] = 1;
             } else {
@@ -895,19 +844,20 @@ void DatalogEngine::insertDRedCounting(std::vector<Triple> newFacts, std::vector
             }
         }
     }
-    std::vector<Triple> allInsertedFacts;
-    std::vector<Triple> insertedFacts;
+    std::vector<IdTriple> allInsertedFacts;
+    std::vector<IdTriple> insertedFacts;
     for(const auto& triple : newFacts) {
         insertedFacts.push_back(triple);
     }
     for(const auto& triple : redrivedFacts) {
         insertedFacts.push_back(triple);
     }
+    DeltaRelation delta(store);
     while(true) {
-        std::vector<Triple> deltaA;
+        std::vector<IdTriple> deltaA;
         // delta_A = N_A - (I - D + A)
         for(const auto& triple: insertedFacts) {
-            if (store.getNodeByTriple(triple) == nullptr) {
+            if (!store.contains(triple)) {
                 deltaA.push_back(triple);
             }
         }
@@ -915,85 +865,46 @@ void DatalogEngine::insertDRedCounting(std::vector<Triple> newFacts, std::vector
         if(deltaA.empty())
             break;
         // A = A U delta_A
-        for (const auto& fact : deltaA) {
-            if(store.getNodeByTriple(fact) == nullptr) {
-                store.addTriple(fact);
-                allInsertedFacts.push_back(fact);
+        {
+            auto lock = store.lockExclusive();
+            for (const auto& fact : deltaA) {
+                if(store.addTriple(fact)) {
+                    allInsertedFacts.push_back(fact);
+                }
             }
         }
-        std::set<Triple> inferredFactsSet;
-        for (const auto& triple : deltaA) {
-            // 根据谓语查找规则
-            auto it = nonrecursiveRulesMap.find(triple.predicate);
-            if (it != nonrecursiveRulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = nonrecursiveRules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = triple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = triple.object;
-                    }
-
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings); 
-                    for(const auto& fact : inferredFacts) {
-                        if(nonrecursiveNum.find(fact) == nonrecursiveNum.end()) {
-                            nonrecursiveNum[fact] = 1;
-                        } else {
-                            nonrecursiveNum[fact]++;
-                        }
-                        if (store.getNodeByTriple(fact) == nullptr) {
-                            inferredFactsSet.insert(fact);
-                        }
-                    }
-                }
+        // update: 与 insertDRed 相同，delta_A 整批建成增量关系，每个 (规则, 模式) 只 join 一次，
+        // 每个用到 delta_A 的推导恰好计数一次
+        delta.assign(deltaA);
+        std::set<IdTriple> inferredFactsSet;
+        std::vector<IdTriple> inferredFacts;
+        joinTriggers(nonrecursiveRules, nonrecursiveRulesMap, delta, inferredFacts);
+        for(const auto& fact : inferredFacts) {
+            if(nonrecursiveNum.find(fact) == nonrecursiveNum.end()) {
+                nonrecursiveNum[fact] = 1;
+            } else {
+                nonrecursiveNum[fact]++;
             }
-
-            it = recursiveRulesMap.find(triple.predicate);
-            if (it != recursiveRulesMap.end()) {
-                for (const auto& rulePair : it->second) {
-                    size_t ruleIdx = rulePair.first;
-                    size_t patternIdx = rulePair.second;
-                    const Rule& rule = recursiveRules[ruleIdx];
-                    const Triple& pattern = rule.body[patternIdx];
-
-                    // 绑定变量
-                    std::map<std::string, std::string> bindings;
-                    if (isVariable(pattern.subject)) {
-                        bindings[pattern.subject] = triple.subject;
-                    }
-                    if (isVariable(pattern.object)) {
-                        bindings[pattern.object] = triple.object;
-                    }
-
-                    // 调用leapfrogTriejoin推理新事实
-                    std::vector<Triple> inferredFacts;
-                    leapfrogTriejoin(store.getTriePSORoot(), store.getTriePOSRoot(), rule, inferredFacts, bindings); 
-                    for(const auto& fact : inferredFacts) {
-                        if(recursiveNum.find(fact) == recursiveNum.end()) {
-                            recursiveNum[fact] = 1;
-                        } else {
-                            recursiveNum[fact]++;
-                        }
-                        if (store.getNodeByTriple(fact) == nullptr) {
-                            inferredFactsSet.insert(fact);
-                        }
-                    }
-                }
+            if (!store.contains(fact)) {
+                inferredFactsSet.insert(fact);
+            }
+        }
+        inferredFacts.clear();
+        joinTriggers(recursiveRules, recursiveRulesMap, delta, inferredFacts);
+        for(const auto& fact : inferredFacts) {
+            if(recursiveNum.find(fact) == recursiveNum.end()) {
+                recursiveNum[fact] = 1;
+            } else {
+                recursiveNum[fact]++;
+            }
+            if (!store.contains(fact)) {
+                inferredFactsSet.insert(fact);
             }
         }
         insertedFacts.clear();
         for(auto& fact : inferredFactsSet) {
             // 将推理出的事实加入到insertedFacts中
-            if (store.getNodeByTriple(fact) == nullptr) {
+            if (!store.contains(fact)) {
                 insertedFacts.push_back(fact);
             }
         }
@@ -1005,305 +916,547 @@ void DatalogEngine::insertDRedCounting(std::vector<Triple> newFacts, std::vector
     // }
 
 }
-bool DatalogEngine::isVariable(const std::string& term) {
-    // 判断是否为变量，变量以?开头，如"?x"
-    return !term.empty() && term[0] == '?';
+bool DatalogEngine::isVariable(TermId term) {
+    // 判断是否为变量，变量 ID 带有 VARIABLE_BIT 标记
+    return Dictionary::isVariable(term);
 }
 
-// 输入两棵trie，以及一条规则，将NewFacts里面填入推出的Facts
-void DatalogEngine::leapfrogTriejoin(
-    TrieNode* psoRoot, TrieNode* posRoot,
-    const Rule& rule,
-    std::vector<Triple>& newFacts,
-    std::map<std::string, std::string>& bindings
-) {
+bool DatalogEngine::isExplicit(const IdTriple& fact) const {
+    if (explicitInserted.count(fact) != 0) {
+        return true;
+    }
+    return explicitDeleted.count(fact) == 0 && explicitBase.contains(fact);
+}
 
-    std::set<std::string> variables;
-    std::map<std::string, std::vector<std::pair<int, int>>> varPositions; // 变量 -> [(triple_idx, position)]
-    // todo: 能不能根据varPositions来筛选代入新三元组对应变量后可能产生冲突的三元组模式？需要找出主语和宾语变量都包含在新三元组对应模式中的三元组模式
-    // todo: 例如新三元组对应模式为A(?x,?y)，则需要找其他(?x,?y)、(?y,?x)、(?x,?x)、(?y,?y)的模式，并查询代入新值后的三元组是否存在于事实库中
-    // todo: 相当于对于两个[(idx, pos)]数组，找出所有idx，使(idx, 0)和(idx, 2)都存在
-    // update: 已实现
-    // printf("Applying rule: %s\n", rule.name.c_str());
-    // printf("bindings: ");
-    // for (const auto& binding : bindings) {
-    //     printf("%s -> %s, ", binding.first.c_str(), binding.second.c_str());
-    // }
-    // printf("\n");
-    for (int i = 0; i < rule.body.size(); i++) {
-        const Triple& triple = rule.body[i];
-        if (isVariable(triple.subject)) {
-            variables.insert(triple.subject);
-            varPositions[triple.subject].emplace_back(i, 0); // 0 表示主语位置
-        }
-        if (isVariable(triple.predicate)) {
-            variables.insert(triple.predicate);
-            varPositions[triple.predicate].emplace_back(i, 1); // 1 表示谓语位置
-            // 实际基本不考虑谓语为变量的情况，但以防万一还是加上
+void DatalogEngine::deleteExplicitFacts(const std::vector<IdTriple>& facts) {
+    for (const auto& fact : facts) {
+        if (explicitInserted.erase(fact) == 0 && explicitBase.contains(fact)) {
+            explicitDeleted.insert(fact);
         }
-        if (isVariable(triple.object)) {
-            variables.insert(triple.object);
-            varPositions[triple.object].emplace_back(i, 2); // 2 表示宾语位置
+    }
+}
+
+void DatalogEngine::insertExplicitFacts(const std::vector<IdTriple>& facts) {
+    for (const auto& fact : facts) {
+        if (explicitDeleted.erase(fact) == 0 && !explicitBase.contains(fact)) {
+            explicitInserted.insert(fact);
         }
     }
+}
 
-    if (!checkConflictingTriples(bindings, varPositions, rule)) {
+void DatalogEngine::rebaseExplicitFacts() {
+    if (explicitInserted.empty() && explicitDeleted.empty()) {
         return;
     }
+    if (explicitStore == nullptr) {
+        // 第一次修改显式事实：拷贝一次到自有的事实库，下面重新固定时释放对原事实库的固定
+        explicitStore = std::make_unique<TripleStore>();
+        for (const auto& fact : getExplicitFacts()) {
+            explicitStore->addTriple(fact);
+        }
+    } else {
+        // 先释放旧版本，explicitStore 上没有其他固定的版本，修改时不需要保留历史
+        explicitBase = StoreVersion();
+        for (const auto& fact : explicitDeleted) {
+            explicitStore->deleteTriple(fact);
+        }
+        for (const auto& fact : explicitInserted) {
+            explicitStore->addTriple(fact);
+        }
+    }
+    explicitInserted.clear();
+    explicitDeleted.clear();
+    explicitBase = explicitStore->pinVersion();
+}
 
-    // std::map<std::string, std::string> bindings;
-    // 对每个变量进行leapfrog join
-    join_by_variable(psoRoot, posRoot, rule, variables, varPositions, bindings, 0, newFacts);
+std::vector<IdTriple> DatalogEngine::getExplicitFacts() const {
+    std::vector<IdTriple> facts;
+    for (const auto& fact : explicitBase.getAllIdTriples()) {
+        if (explicitDeleted.count(fact) == 0) {
+            facts.push_back(fact);
+        }
+    }
+    facts.insert(facts.end(), explicitInserted.begin(), explicitInserted.end());
+    return facts;
 }
 
-// // 输入两棵trie，以及一条规则，将NewFacts里面填入推出的Facts
-// void DatalogEngine::leapfrogTriejoinBackwards(
-//     TrieNode* psoRoot, TrieNode* posRoot,
-//     const Rule& rule,
-//     std::vector<Triple>& newFacts,
-//     std::map<std::string, std::string>& bindings,
-//     Triple& currentTriple
-// ) {
-
-//     std::set<std::string> variables;
-//     std::map<std::string, std::vector<std::pair<int, int>>> varPositions; // 变量 -> [(triple_idx, position)]
-
-//     for (int i = 0; i < rule.body.size(); i++) {
-//         const Triple& triple = rule.body[i];
-//         if (isVariable(triple.subject)) {
-//             variables.insert(triple.subject);
-//             varPositions[triple.subject].emplace_back(i, 0); // 0 表示主语位置
-//         }
-//         if (isVariable(triple.predicate)) {
-//             variables.insert(triple.predicate);
-//             varPositions[triple.predicate].emplace_back(i, 1); // 1 表示谓语位置
-//             // 实际基本不考虑谓语为变量的情况，但以防万一还是加上
-//         }
-//         if (isVariable(triple.object)) {
-//             variables.insert(triple.object);
-//             varPositions[triple.object].emplace_back(i, 2); // 2 表示宾语位置
-//         }
-//     }
-
-//     if (!checkConflictingTriples(bindings, varPositions, rule)) {
-//         return;
-//     }
-
-//     const Triple& head = rule.head;
-//     bindings[head.subject] = currentTriple.subject;
-//     bindings[head.object] = currentTriple.object;
-
-
-//     // std::map<std::string, std::string> bindings;
-//     // 对每个变量进行leapfrog join
-//     join_by_variable(psoRoot, posRoot, rule, variables, varPositions, bindings, 0, newFacts);
-// }
+// 输入一条规则，在事实库的各顺序 Trie 上做 leapfrog triejoin，将NewFacts里面填入推出的Facts
+// update: 按编译好的 RulePlan 执行，变量的绑定值保存在按槽位下标的数组中
+void DatalogEngine::leapfrogTriejoin(
+    const IdRule& rule,
+    std::vector<IdTriple>& newFacts,
+    size_t trigger,
+    const IdTriple& fact,
+    const Morsel& morsel
+) {
+    const RulePlan& plan = rulePlans.at(&rule);
+    size_t planIdx = trigger == NO_TRIGGER ? plan.body.size() + 1 : (trigger == HEAD_TRIGGER ? plan.body.size() : trigger);
+    const TriggerPlan& triggerPlan = plan.triggers[planIdx];
+    // 每个线程的工作区在多次调用之间复用
+    thread_local JoinFrame frame;
+    frame.prepare(plan, triggerPlan);
+    frame.morsel = morsel;
+    TermId* values = frame.slots.data();
+
+    if (trigger != NO_TRIGGER) {
+        const PlanPattern& pattern = trigger == HEAD_TRIGGER ? plan.head : plan.body[trigger];
+        // 规则头触发时谓语由调用方匹配，只绑定主语和宾语
+        for (int position = 0; position < 3; position += trigger == HEAD_TRIGGER ? 2 : 1) {
+            const PlanTerm& term = pattern[position];
+            TermId value = fact.at(position);
+            if (!term.isVariable()) {
+                if (term.constant != value) {
+                    return;
+                }
+                continue;
+            }
+            // 同一变量在模式中出现两次时两处的值必须相同
+            for (int earlier = 0; earlier < position; earlier++) {
+                if (pattern[earlier].slot == term.slot && fact.at(earlier) != value) {
+                    return;
+                }
+            }
+            values[term.slot] = value;
+        }
+    }
+
+    // 触发绑定后已完全确定的模式在编译时已找出，其中任意一个不在事实库中时不可能推出新事实
+    for (int patternIdx : triggerPlan.checkedPatterns) {
+        if (!store.contains(instantiate(plan.body[patternIdx], values))) {
+            return;
+        }
+    }
+    join_by_variable(plan, triggerPlan, 0, frame, newFacts);
+}
 
-void DatalogEngine::join_by_variable(
-    TrieNode* psoRoot, TrieNode* posRoot,
-    const Rule& rule,  // 当前规则
-    const std::set<std::string>& variables,  // 当前规则的变量全集
-    const std::map<std::string, std::vector<std::pair<int, int>>>& varPositions,  // 变量 -> [(变量所在三元组模式在规则体中的下标, 主0/谓1/宾2)]
-    std::map<std::string, std::string>& bindings,  // 变量 -> 变量当前的绑定值（常量，未绑定则为空）
-    int varIdx,
-    std::vector<Triple>& newFacts
+size_t DatalogEngine::leapfrogTriejoinDelta(
+    const IdRule& rule,
+    size_t pattern,
+    const DeltaRelation& delta,
+    size_t batch,
+    std::vector<IdTriple>& newFacts,
+    const Morsel& morsel
 ) {
+    const RulePlan& plan = rulePlans.at(&rule);
+    const TriggerPlan& triggerPlan = plan.deltas[pattern];
+    thread_local JoinFrame frame;
+    frame.prepare(plan, triggerPlan);
+    frame.delta = &delta;
+    frame.deltaBatch = batch;
+    frame.morsel = morsel;
+    const TermId* values = frame.slots.data();
+
+    // 没有变量的模式：增量模式须在这一批中，之前的模式须在事实库中，之后的模式须是旧事实
+    for (int patternIdx : triggerPlan.checkedPatterns) {
+        IdTriple triple = instantiate(plan.body[patternIdx], values);
+        bool matched = patternIdx == triggerPlan.deltaPattern ? delta.batchContains(batch, triple) : store.contains(triple);
+        if (!matched || (patternIdx > triggerPlan.deltaPattern && delta.contains(triple))) {
+            return 0;
+        }
+    }
+    join_by_variable(plan, triggerPlan, 0, frame, newFacts);
+    return frame.skippedDerivations;
+}
 
-    // printf("join_by_variable called with varIdx: %d\n", varIdx);
-    // printf("Current bindings: ");
-    // for (const auto& binding : bindings) {
-    //     printf("%s -> %s, ", binding.first.c_str(), binding.second.c_str());
-    // }
-    // printf("\n");  
-    // 当所有变量都已绑定时，生成新的事实
-    if (varIdx >= variables.size()) {
-        //遍历rule的body中的三元组，是否在store中存在
-        for( const auto& triple : rule.body) {
-            const Triple &substitutedTriple = Triple(
-                substituteVariable(triple.subject, bindings),
-                substituteVariable(triple.predicate, bindings),
-                substituteVariable(triple.object, bindings)
-            );
-            // printf("Checking triple: (%s, %s, %s)\n", substitutedTriple.subject.c_str(), substitutedTriple.predicate.c_str(), substitutedTriple.object.c_str());
-            if (store.getNodeByTriple(substitutedTriple) == nullptr) {
-                // 如果三元组不存在，则不生成新事实
-                return;
-            }
+void DatalogEngine::joinTriggers(const std::vector<IdRule>& ruleList, const RulesMap& rulesIndex,
+                                 const DeltaRelation& delta, std::vector<IdTriple>& newFacts) {
+    for (size_t batch = 0; batch < delta.batchCount(); batch++) {
+        // 按谓语分组：这一批中出现的谓语触发的 (规则, 模式) 只 join 一次
+        std::set<std::pair<size_t, size_t>> rulePatterns;
+        for (TermId predicate : delta.getPredicates(batch)) {
+            const auto& triggers = triggersOf(rulesIndex, predicate);
+            rulePatterns.insert(triggers.begin(), triggers.end());
         }
-        std::string newSubject = substituteVariable(rule.head.subject, bindings);
-        std::string newPredicate = substituteVariable(rule.head.predicate, bindings);
-        std::string newObject = substituteVariable(rule.head.object, bindings);
+        for (const auto& rulePair : rulePatterns) {
+            leapfrogTriejoinDelta(ruleList[rulePair.first], rulePair.second, delta, batch, newFacts);
+        }
+    }
+}
 
-        newFacts.emplace_back(newSubject, newPredicate, newObject);
-        return;
+RulePlan DatalogEngine::compileRule(const IdRule& rule) {
+    RulePlan plan;
+    std::map<TermId, int> slotOf;
+    auto compileTerm = [&](TermId term) {
+        PlanTerm compiled;
+        if (!isVariable(term)) {
+            compiled.constant = term;
+            return compiled;
+        }
+        auto it = slotOf.find(term);
+        if (it == slotOf.end()) {
+            it = slotOf.emplace(term, static_cast<int>(plan.variables.size())).first;
+            plan.variables.push_back(term);
+        }
+        compiled.slot = it->second;
+        return compiled;
+    };
+    for (const auto& triple : rule.body) {
+        plan.body.push_back({compileTerm(triple.subject), compileTerm(triple.predicate), compileTerm(triple.object)});
     }
-    // 获取当前要处理的变量
-    auto varIt = variables.begin();
-    std::advance(varIt, varIdx);
-    std::string currentVar = *varIt;
+    plan.head = {compileTerm(rule.head.subject), compileTerm(rule.head.predicate), compileTerm(rule.head.object)};
+    return plan;
+}
 
-    // 如果当前变量已绑定，则直接处理下一个
-    if (bindings.find(currentVar) != bindings.end()) {
-        join_by_variable(psoRoot, posRoot, rule, variables, varPositions, bindings, varIdx + 1, newFacts);
-        return;
+void DatalogEngine::planJoins() {
+    // 作为规则头出现的谓语在推理过程中会增长，计划时为空不代表之后为空
+    std::set<TermId> derivedPredicates;
+    for (const auto& rule : rules) {
+        derivedPredicates.insert(rule.head.predicate);
     }
-    // 对当前变量创建迭代器
-    std::vector<TrieIterator*> iterators;
-    for (const auto& pos : varPositions.at(currentVar)) {
-        int tripleIdx = pos.first;
-        int position = pos.second;
-        const Triple& triple = rule.body[tripleIdx];
-
-        TrieIterator* it = nullptr;
-
-        // 根据变量位置选择适当的Trie
-        if (position == 0) { // 主语位置
-            // 如果宾语已绑定，就从posTrie中对应宾语的子节点中查找
-            if (!isVariable(triple.object) || bindings.find(triple.object) != bindings.end()) {
-                it = new TrieIterator(posRoot);
-                // 对谓语进行seek
-                std::string predValue = substituteVariable(triple.predicate, bindings);
-                it->seek(predValue);
-                if (!it->atEnd() && it->key() == predValue) {
-                    // 对已确定的宾语进行seek
-                    TrieIterator objIt = it->open();
-                    std::string objValue = substituteVariable(triple.object, bindings);
-                    objIt.seek(objValue);
-                    if (!objIt.atEnd() && objIt.key() == objValue) {
-                        iterators.push_back(new TrieIterator(objIt.open()));
-                    }
+    for (auto& [rule, plan] : rulePlans) {
+        plan.triggers.clear();
+        for (size_t i = 0; i < rule->body.size(); i++) {
+            plan.triggers.push_back(compileTrigger(plan, i, planVariableOrder(*rule, i, derivedPredicates)));
+        }
+        plan.triggers.push_back(compileTrigger(plan, HEAD_TRIGGER,
+                                               planVariableOrder(*rule, HEAD_TRIGGER, derivedPredicates)));
+        plan.triggers.push_back(compileTrigger(plan, NO_TRIGGER,
+                                               planVariableOrder(*rule, NO_TRIGGER, derivedPredicates)));
+        // 增量模式没有预先绑定的变量，但增量关系通常远小于完整的关系，变量顺序与以它为触发模式时相同
+        plan.deltas.clear();
+        for (size_t i = 0; i < rule->body.size(); i++) {
+            TriggerPlan deltaPlan = compileTrigger(plan, NO_TRIGGER, planVariableOrder(*rule, i, derivedPredicates));
+            deltaPlan.deltaPattern = static_cast<int>(i);
+            for (auto& level : deltaPlan.levels) {
+                for (auto& access : level.accesses) {
+                    access.delta = access.pattern == deltaPlan.deltaPattern;
                 }
             }
-            // 否则，从psoTrie中查找
-            else {
-                it = new TrieIterator(psoRoot);
-                // 对谓语进行seek
-                std::string predValue = substituteVariable(triple.predicate, bindings);
-                it->seek(predValue);
-                if (!it->atEnd() && it->key() == predValue) {
-                    TrieIterator subIt = it->open();
-                    iterators.push_back(new TrieIterator(subIt));
-                }
+            for (size_t j = i + 1; j < rule->body.size(); j++) {
+                deltaPlan.oldPatterns.push_back(static_cast<int>(j));
             }
+            plan.deltas.push_back(std::move(deltaPlan));
         }
-        // 这里暂时不考虑谓语为变量，即position == 1的情况
-        else if (position == 2) { // 宾语位置
-            // 如果主语已绑定，就从psoTrie中对应主语的子节点中查找
-            if (!isVariable(triple.subject) || bindings.find(triple.subject) != bindings.end()) {
-                it = new TrieIterator(psoRoot);
-                // 对谓语进行seek
-                std::string predValue = substituteVariable(triple.predicate, bindings);
-                it->seek(predValue);
-                if (!it->atEnd() && it->key() == predValue) {
-                    // 对已确定的主语进行seek
-                    TrieIterator subjIt = it->open();
-                    std::string subjValue = substituteVariable(triple.subject, bindings);
-                    subjIt.seek(subjValue);
-                    if (!subjIt.atEnd() && subjIt.key() == subjValue) {
-                        iterators.push_back(new TrieIterator(subjIt.open()));
-                    }
-                }
+    }
+}
+
+TriggerPlan DatalogEngine::compileTrigger(const RulePlan& plan, size_t trigger, const std::vector<TermId>& order) const {
+    TriggerPlan compiled;
+    std::vector<bool> bound(plan.variables.size(), false);
+    auto slotOf = [&](TermId variable) {
+        return static_cast<int>(std::find(plan.variables.begin(), plan.variables.end(), variable) - plan.variables.begin());
+    };
+    size_t first = 0;
+    if (trigger != NO_TRIGGER) {
+        const PlanPattern& pattern = trigger == HEAD_TRIGGER ? plan.head : plan.body[trigger];
+        for (int position = 0; position < 3; position += trigger == HEAD_TRIGGER ? 2 : 1) {
+            if (pattern[position].isVariable()) {
+                bound[pattern[position].slot] = true;
             }
-            // 否则，从posTrie中查找
-            else {
-                it = new TrieIterator(posRoot);
-                // 对谓语进行seek
-                std::string predValue = substituteVariable(triple.predicate, bindings);
-                it->seek(predValue);
-                if (!it->atEnd() && it->key() == predValue) {
-                    TrieIterator objIt = it->open();
-                    iterators.push_back(new TrieIterator(objIt));
+        }
+        // order 开头为触发时已绑定的变量
+        while (first < order.size() && bound[slotOf(order[first])]) {
+            first++;
+        }
+    }
+    auto isBound = [&](const PlanTerm& term) { return !term.isVariable() || bound[term.slot]; };
+
+    // covered：执行到叶子时已确定存在的模式
+    std::vector<bool> covered(plan.body.size(), false);
+    for (size_t i = 0; i < plan.body.size(); i++) {
+        const PlanPattern& pattern = plan.body[i];
+        if (isBound(pattern[0]) && isBound(pattern[1]) && isBound(pattern[2])) {
+            compiled.checkedPatterns.push_back(static_cast<int>(i));
+            covered[i] = true;
+        }
+    }
+
+    // 为每个变量选择 Trie 顺序：已绑定的位置（常量或已绑定变量）作为前缀，变量位置紧随其后
+    // 例如主语为变量且谓语、宾语已绑定时使用 POS，谓语为变量且只有主语已绑定时使用 SPO；优先使用默认维护的 PSO、POS
+    static const TrieOrder orders[] = {TrieOrder::PSO, TrieOrder::POS, TrieOrder::SPO,
+                                       TrieOrder::SOP, TrieOrder::OSP, TrieOrder::OPS};
+    for (size_t idx = first; idx < order.size(); idx++) {
+        JoinLevel level;
+        level.slot = slotOf(order[idx]);
+        for (size_t i = 0; i < plan.body.size(); i++) {
+            const PlanPattern& pattern = plan.body[i];
+            for (int position = 0; position < 3; position++) {
+                if (pattern[position].slot != level.slot) {
+                    continue;
+                }
+                bool prefixBound[3];
+                int boundCount = 0;
+                for (int other = 0; other < 3; other++) {
+                    prefixBound[other] = other != position && pattern[other].slot != level.slot && isBound(pattern[other]);
+                    boundCount += prefixBound[other];
                 }
+                for (TrieOrder trieOrder : orders) {
+                    const int* positions = orderPositions(trieOrder);
+                    bool usable = positions[boundCount] == position && store.getTrieRoot(trieOrder) != nullptr;
+                    for (int prefix = 0; prefix < boundCount; prefix++) {
+                        usable = usable && prefixBound[positions[prefix]];
+                    }
+                    if (!usable) {
+                        continue;
+                    }
+                    PatternAccess access;
+                    access.pattern = static_cast<int>(i);
+                    access.order = trieOrder;
+                    access.prefixLength = boundCount;
+                    for (int prefix = 0; prefix < boundCount; prefix++) {
+                        access.prefix[prefix] = pattern[positions[prefix]];
+                    }
+                    // 另外两个位置都在前缀中时，交集中的每个键都对应一个存在的三元组
+                    covered[i] = covered[i] || boundCount == 2;
+                    level.accesses.push_back(access);
+                    break;
+                }
+                // 没有可用的索引顺序（未维护全部顺序时谓语为变量），该模式留给最终检查
             }
         }
-
-        if (it && iterators.empty()) {
-            delete it;
+        bound[level.slot] = true;
+        level.firstIterator = compiled.iteratorCount;
+        compiled.iteratorCount += level.accesses.size();
+        compiled.levels.push_back(std::move(level));
+    }
+    // 只剩没有可用索引的模式（谓语为变量）和同一变量出现两次的模式需要在叶子处检查
+    for (size_t i = 0; i < plan.body.size(); i++) {
+        if (!covered[i]) {
+            compiled.verifiedPatterns.push_back(static_cast<int>(i));
         }
     }
+    return compiled;
+}
 
-    // 对当前变量执行leapfrog join
-    if (!iterators.empty()) {
-        LeapfrogJoin lf(iterators);
-        while (!lf.atEnd()) {
-
-            std::string key = lf.key();
-            bindings[currentVar] = key;  // 将当前变量绑定到迭代器的key上
-            // 递归处理下一个变量
-            join_by_variable(psoRoot, posRoot, rule, variables, varPositions, bindings, varIdx + 1, newFacts);
-
-            lf.next();
+std::vector<TermId> DatalogEngine::planVariableOrder(const IdRule& rule, size_t trigger,
+                                                     const std::set<TermId>& derivedPredicates) const {
+    std::vector<TermId> order;
+    std::set<TermId> bound;
+    auto bindVariable = [&](TermId term) {
+        if (isVariable(term) && bound.insert(term).second) {
+            order.push_back(term);
         }
+    };
+    // 触发方式预先绑定的变量排在最前，join 时直接跳过
+    if (trigger == HEAD_TRIGGER) {
+        bindVariable(rule.head.subject);
+        bindVariable(rule.head.object);
+    } else if (trigger != NO_TRIGGER) {
+        const IdTriple& pattern = rule.body[trigger];
+        bindVariable(pattern.subject);
+        bindVariable(pattern.predicate);
+        bindVariable(pattern.object);
+    }
 
-        // 清理迭代器
-        for (auto it : iterators) {
-            delete it;
+    std::set<TermId> remaining;
+    for (const auto& pattern : rule.body) {
+        for (int position = 0; position < 3; position++) {
+            TermId term = pattern.at(position);
+            if (isVariable(term) && bound.find(term) == bound.end()) {
+                remaining.insert(term);
+            }
         }
     }
-
-    // 删除当前变量的绑定
-    bindings.erase(currentVar);
-
+    // 贪心：每次选择在所有含它的模式中候选值估计的最小值最小的变量（leapfrog 的交集不会多于最小的那个），
+    // 相同时按变量 ID，与原先的字典序一致
+    while (!remaining.empty()) {
+        TermId best = Dictionary::NONE;
+        double bestCost = 0;
+        for (TermId variable : remaining) {
+            double cost = -1;
+            for (const auto& pattern : rule.body) {
+                if (pattern.subject != variable && pattern.predicate != variable && pattern.object != variable) {
+                    continue;
+                }
+                double estimate = estimateCandidates(pattern, variable, bound, derivedPredicates);
+                cost = cost < 0 ? estimate : std::min(cost, estimate);
+            }
+            if (best == Dictionary::NONE || cost < bestCost) {
+                best = variable;
+                bestCost = cost;
+            }
+        }
+        bindVariable(best);
+        remaining.erase(best);
+    }
+    return order;
 }
 
-// 辅助函数：若绑定中存在变量则替换其绑定的值，否则返回原字符串（此时为常量）
-std::string DatalogEngine::substituteVariable(const std::string& term, const std::map<std::string, std::string>& bindings) {
-    if (isVariable(term) && bindings.find(term) != bindings.end()) {
-        return bindings.at(term);
+double DatalogEngine::estimateCandidates(const IdTriple& pattern, TermId variable, const std::set<TermId>& bound,
+                                         const std::set<TermId>& derivedPredicates) const {
+    auto isBound = [&](TermId term) {
+        return term != variable && (!isVariable(term) || bound.find(term) != bound.end());
+    };
+    double tripleCount = static_cast<double>(store.size());
+    if (isVariable(pattern.predicate)) {
+        // 谓语为变量时没有按谓语的统计，只粗略估计
+        double predicateCount = std::max<double>(1, static_cast<double>(store.getPredicates().size()));
+        if (pattern.predicate == variable) {
+            return predicateCount;
+        }
+        return isBound(pattern.predicate) ? tripleCount / predicateCount : tripleCount;
+    }
+
+    TripleStore::PredicateStats stats;
+    if (!store.getPredicateStats(pattern.predicate, stats)) {
+        // 显式事实中没有、也不会被推出的谓语，模式恒为空
+        return derivedPredicates.count(pattern.predicate) ? tripleCount : 0;
     }
-    return term;
+    if (pattern.subject == variable) {
+        return isBound(pattern.object) ? stats.perObject.average : static_cast<double>(stats.perSubject.distinct);
+    }
+    return isBound(pattern.subject) ? stats.perSubject.average : static_cast<double>(stats.perObject.distinct);
 }
 
-bool DatalogEngine::checkConflictingTriples(
-    const std::map<std::string, std::string>& bindings,
-    const std::map<std::string, std::vector<std::pair<int, int>>>& varPositions,
-    const Rule& rule
+void DatalogEngine::join_by_variable(
+    const RulePlan& plan,  // 当前规则的编译结果
+    const TriggerPlan& triggerPlan,  // 当前触发方式下的执行计划
+    size_t level,  // 当前要绑定的变量在 triggerPlan.levels 中的下标
+    JoinFrame& frame,  // 槽位 -> 变量当前的绑定值，以及各层的迭代器
+    std::vector<IdTriple>& newFacts
 ) const {
-    // 遍历bindings中的变量
-    for (const auto& [var, value] : bindings) {
-        if (varPositions.find(var) == varPositions.end()) {
-            continue; // 如果变量不在varPositions中，跳过
+    const TermId* slots = frame.slots.data();
+    // 当所有变量都已绑定时，生成新的事实
+    if (level >= triggerPlan.levels.size()) {
+        //遍历rule的body中的三元组，是否在store中存在
+        // update: 只检查 join 没有保证存在的模式
+        for (int patternIdx : triggerPlan.verifiedPatterns) {
+            IdTriple triple = instantiate(plan.body[patternIdx], slots);
+            bool exists = patternIdx == triggerPlan.deltaPattern ? frame.delta->batchContains(frame.deltaBatch, triple)
+                                                                 : store.contains(triple);
+            if (!exists) {
+                // 如果三元组不存在，则不生成新事实
+                return;
+            }
         }
-
-        const auto& positions = varPositions.at(var);
-        std::map<int, std::set<int>> idxToPos;
-
-        // 构建idx到pos的映射
-        for (const auto& [idx, pos] : positions) {
-            idxToPos[idx].insert(pos);
+        // 之后的模式用到增量事实的推导，会在以该模式为增量模式的那次 join 中产生
+        for (int patternIdx : triggerPlan.oldPatterns) {
+            if (frame.delta->contains(instantiate(plan.body[patternIdx], slots))) {
+                frame.skippedDerivations++;
+                return;
+            }
+        }
+        newFacts.push_back(instantiate(plan.head, slots));
+        return;
+    }
+    const JoinLevel& joinLevel = triggerPlan.levels[level];
+
+    // 对当前变量打开迭代器，沿计划中的前缀逐层 seek 到当前变量所在的层
+    // update: 迭代器不再逐个 new，使用工作区中为本层预留的位置
+    TrieIterator** iterators = frame.iteratorPointers.data() + joinLevel.firstIterator;
+    size_t count = joinLevel.accesses.size();
+    for (size_t i = 0; i < count; i++) {
+        const PatternAccess& access = joinLevel.accesses[i];
+        const TrieNode* node = access.delta ? frame.delta->getTrieRoot(frame.deltaBatch, access.order)
+                                            : store.getTrieRoot(access.order);
+        for (int prefix = 0; prefix < access.prefixLength && node != nullptr; prefix++) {
+            node = node->findChild(access.prefix[prefix].value(slots));
+        }
+        if (node == nullptr) {
+            // 前缀在事实库中不存在，交集必为空
+            return;
+        }
+        TrieIterator& iterator = frame.iterators[joinLevel.firstIterator + i];
+        iterator.reset(node);
+        if (level == 0 && frame.morsel.begin != Dictionary::NONE) {
+            iterator.seek(frame.morsel.begin);
         }
+        iterators[i] = &iterator;
+    }
 
-        // 检查是否同时存在(idx, 0)和(idx, 2)
-        for (const auto& [idx, posSet] : idxToPos) {
-            if (posSet.count(0) && posSet.count(2)) {
-                // 构造实际的三元组
-                const Triple& pattern = rule.body[idx];
-                std::string subject = substituteVariable(pattern.subject, bindings);
-                std::string predicate = substituteVariable(pattern.predicate, bindings);
-                std::string object = substituteVariable(pattern.object, bindings);
+    // 对当前变量执行leapfrog join
+    if (count != 0) {
+        LeapfrogJoin lf(iterators, count);
+        while (!lf.atEnd()) {
+            if (level == 0 && frame.morsel.end != Dictionary::NONE && lf.key() >= frame.morsel.end) {
+                break;
+            }
+            frame.slots[joinLevel.slot] = lf.key();  // 将当前变量绑定到迭代器的key上
+            // 递归处理下一个变量
+            join_by_variable(plan, triggerPlan, level + 1, frame, newFacts);
 
-                Triple actualTriple(subject, predicate, object);
+            lf.next();
+        }
+    }
+}
 
-                // 检查三元组是否存在于事实库中
-                if (store.getNodeByTriple(actualTriple) != nullptr) {
-                    return false;
-                }
+std::vector<Morsel> DatalogEngine::splitFirstLevel(const TriggerPlan& triggerPlan, const DeltaRelation* delta,
+                                                   size_t batch, size_t morselCount) const {
+    std::vector<Morsel> morsels(1);
+    if (morselCount <= 1 || triggerPlan.levels.empty()) {
+        return morsels;
+    }
+    // 最外层的交集不会多于键数最少的那个模式，以它的键为分段边界
+    const TrieNode* smallest = nullptr;
+    for (const auto& access : triggerPlan.levels[0].accesses) {
+        const TrieNode* node = access.delta ? delta->getTrieRoot(batch, access.order) : store.getTrieRoot(access.order);
+        for (int prefix = 0; prefix < access.prefixLength && node != nullptr; prefix++) {
+            if (access.prefix[prefix].isVariable()) {
+                return morsels; // 有预先绑定的变量，不是完整的 join
             }
+            node = node->findChild(access.prefix[prefix].constant);
+        }
+        if (node == nullptr) {
+            return morsels;
+        }
+        if (smallest == nullptr || node->keyCount() < smallest->keyCount()) {
+            smallest = node;
         }
     }
+    if (smallest == nullptr) {
+        return morsels;
+    }
+    morselCount = std::min(morselCount, smallest->keyCount() / MIN_MORSEL_KEYS);
+    if (morselCount <= 1) {
+        return morsels;
+    }
+    size_t step = smallest->keyCount() / morselCount;
+    morsels.clear();
+    TermId begin = Dictionary::NONE;
+    TrieIterator iterator(smallest);
+    for (size_t i = 0; !iterator.atEnd(); i++, iterator.next()) {
+        if (i != 0 && i % step == 0 && morsels.size() + 1 < morselCount) {
+            morsels.push_back({begin, iterator.key()});
+            begin = iterator.key();
+        }
+    }
+    morsels.push_back({begin, Dictionary::NONE});
+    return morsels;
+}
+
+void DatalogEngine::evaluateRule(size_t ruleIndex, std::vector<IdTriple>& newFacts, TaskScheduler& scheduler) {
+    const IdRule& rule = rules[ruleIndex];
+    const RulePlan& plan = rulePlans.at(&rule);
+    size_t morselCount = scheduler.threadCount() > 1 ? scheduler.threadCount() * MORSELS_PER_THREAD : 1;
+    std::vector<Morsel> morsels = splitFirstLevel(plan.triggers[plan.body.size() + 1], nullptr, 0, morselCount);
+    std::vector<std::vector<IdTriple>> outputs(scheduler.threadCount());
+    TaskScheduler::TaskGroup group;
+    for (const Morsel& morsel : morsels) {
+        scheduler.submit(group, [this, &rule, &outputs, morsel](size_t worker) {
+            leapfrogTriejoin(rule, outputs[worker], NO_TRIGGER, IdTriple(), morsel);
+        });
+    }
+    scheduler.wait(group);
+    for (const auto& output : outputs) {
+        newFacts.insert(newFacts.end(), output.begin(), output.end());
+    }
+}
 
-    // 检查规则体中是否有只含常量不含变量的三元组模式
-    for (const auto& triple : rule.body) {
-        if (!isVariable(triple.subject) && !isVariable(triple.predicate) && !isVariable(triple.object)) {
-            // 构造实际的三元组
-            Triple actualTriple(triple.subject, triple.predicate, triple.object);
+IdTriple DatalogEngine::instantiate(const PlanPattern& pattern, const TermId* slots) {
+    return IdTriple(pattern[0].value(slots), pattern[1].value(slots), pattern[2].value(slots));
+}
 
-            // 检查三元组是否存在于事实库中
-            if (store.getNodeByTriple(actualTriple) != nullptr) {
-                return false;
-            }
+bool DatalogEngine::recover(const WriteAheadLog& log) {
+    // 重放的批次已经在日志中，不再重复写入
+    WriteAheadLog* attached = wal;
+    wal = nullptr;
+    // 按批次记录的路径重放；计数与事实库不一致时（如从快照恢复）计数路径无法使用，改走 leapfrogDRed，结果相同
+    bool ok = log.replay([this](std::vector<Triple>& deletedTriples, std::vector<Triple>& insertedTriples, MaintenancePath path) {
+        if (path == MaintenancePath::CountingDRed && countsValid) {
+            leapfrogDRedCounting(deletedTriples, insertedTriples);
+        } else {
+            leapfrogDRed(deletedTriples, insertedTriples);
         }
-    }
+    });
+    wal = attached;
+    return ok;
+}
 
-    return true;
+bool DatalogEngine::checkpoint(const std::string& snapshotPath) {
+    std::string temporaryPath = snapshotPath + ".tmp";
+    if (!saveSnapshot(temporaryPath) || std::rename(temporaryPath.c_str(), snapshotPath.c_str()) != 0) {
+        return false;
+    }
+    // 快照已包含日志中的所有批次；若在清空日志前崩溃，重放这些批次也只会得到同样的结果
+    return wal == nullptr || wal->reset();
 }
@@ -3,94 +3,238 @@
 
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "ConcurrentTripleSet.h"
+#include "DeltaRelation.h"
+#include "RulePlan.h"
+#include "TaskScheduler.h"
 #include "TripleStore.h"
+#include "WriteAheadLog.h"
 
 
 class DatalogEngine {
 private:
-    TripleStore originalStore;
+    using RulesMap = std::unordered_map<TermId, std::vector<std::pair<size_t, size_t>>>; // 谓语 -> [规则下标, 规则体中谓语下标]
+
+    // 显式事实 = explicitBase - explicitDeleted + explicitInserted
+    // explicitBase 起初是推理前事实库的只读版本（从快照恢复时为单独载入的显式事实），构造时不拷贝整个事实库；
+    // 但固定的版本在释放前会让事实库保留之后删除的、该版本可见的三元组，所以不能一直持有：
+    // 第一批增量维护后显式事实移入引擎自有的 explicitStore，之后每批把两个小集合并入其中并重新固定
+    std::unique_ptr<TripleStore> explicitStore; // 在 explicitBase 之前声明，析构时晚于固定它的版本
+    StoreVersion explicitBase;
+    std::unordered_set<IdTriple, IdTripleHash> explicitInserted;
+    std::unordered_set<IdTriple, IdTripleHash> explicitDeleted;
     TripleStore& store;
-    std::map<Triple, int> recursiveNum;
-    std::map<Triple, int> nonrecursiveNum;
-    std::vector<Rule> rules;
-    std::vector<Rule> recursiveRules;
-    std::vector<Rule> nonrecursiveRules;
-    std::map<std::string, std::vector<std::pair<size_t, size_t>>> rulesMap; // 谓语 -> [规则下标, 规则体中谓语下标]
-    std::map<std::string, std::vector<std::pair<size_t, size_t>>> nonrecursiveRulesMap; // 谓语 -> [规则下标, 规则体中谓语下标]
-    std::map<std::string, std::vector<std::pair<size_t, size_t>>> recursiveRulesMap; // 谓语 -> [规则下标, 规则体中谓语下标]
+    std::unordered_map<IdTriple, int, IdTripleHash> recursiveNum;
+    std::unordered_map<IdTriple, int, IdTripleHash> nonrecursiveNum;
+    // 计数是否与事实库一致：reasonNaive 之后只经过 leapfrogDRedCounting 时成立，reason 和 leapfrogDRed 不维护计数
+    bool countsValid = false;
+    std::vector<IdRule> rules;  // 编码后的规则，常量和变量均为 ID
+    std::vector<IdRule> recursiveRules;
+    std::vector<IdRule> nonrecursiveRules;
+    RulesMap rulesMap; // 谓语 -> [规则下标, 规则体中谓语下标]，谓语为变量的模式记在 NONE 下
+    RulesMap nonrecursiveRulesMap; // 谓语 -> [规则下标, 规则体中谓语下标]
+    RulesMap recursiveRulesMap; // 谓语 -> [规则下标, 规则体中谓语下标]
+    WriteAheadLog* wal = nullptr; // 不为空时，增量维护前先把批次写入日志
+
+    // 分层：谓语依赖图（规则体谓语 -> 规则头谓语）的一个强连通分量，其中的谓语由 rules 中的这些规则推出
+    // 谓语为变量的规则头记为 NONE；规则体中谓语为变量的模式依赖所有推出的谓语
+    struct Stratum {
+        std::vector<size_t> rules;  // 规则在 rules 中的下标
+        bool recursive = false;     // 分量内有依赖边（含自环），需要迭代到不动点
+        size_t level = 0;           // 依赖链的深度，同一深度的分层互不依赖
+    };
+    std::vector<Stratum> strata;    // 按拓扑序（同时按 level）排列
+    std::vector<size_t> ruleStratum; // rules 中的规则 -> 所在分层
+
+    // 连接计划：规则体中变量的绑定顺序，按 (规则, 触发方式) 缓存。触发方式为触发模式在规则体中的下标，
+    // 或 NO_TRIGGER（没有预先绑定的变量）、HEAD_TRIGGER（规则头的变量已绑定，用于重新推导）
+    // 每次推理和增量维护开始时按当前的谓语统计信息重新计算，推理过程中只读
+    static constexpr size_t NO_TRIGGER = SIZE_MAX;
+    static constexpr size_t HEAD_TRIGGER = SIZE_MAX - 1;
+    // update: 规则在构造时编译为 RulePlan，各触发方式的变量顺序和每层使用的索引顺序都记在其中
+    std::map<const IdRule*, RulePlan> rulePlans;
     
     // std::map<std::string, std::vector< size_t>> rulesMap; // 谓语 -> [规则下标]
 
 public:
-    DatalogEngine(TripleStore& store, const std::vector<Rule>& rules) : store(store), originalStore(store), rules(rules) {
+    DatalogEngine(TripleStore& store, const std::vector<Rule>& rules) : DatalogEngine(store, rules, store) {}
+
+    // store 已经包含推理结果（如从快照打开）时使用，explicitFacts 为推理前的显式事实，不需要再调用 reason()
+    // 引擎固定 explicitFacts 的当前版本，之后它本身的修改对引擎不可见；第一批增量维护后释放该版本，
+    // 在此之前 explicitFacts 需要保持有效
+    // 注意计数信息不随快照保存，这种情况下增量维护应使用 leapfrogDRed
+    DatalogEngine(TripleStore& store, const std::vector<Rule>& rules, const TripleStore& explicitFacts)
+            : explicitBase(explicitFacts.pinVersion()), store(store) {
+        // 规则中的常量和变量编码为 ID，推理过程中不再比较字符串
+        encodeRules(rules);
+
         // 将规则分为递归和非递归
-        for (const auto& rule : rules) {
-            bool isRecursive = false;
-            const std::string& headPredicate = rule.head.predicate;
+        // update: 按谓语依赖图的强连通分量分层，规则体中有与规则头在同一分量的谓语时为递归规则（含相互递归）
+        stratifyRules();
+
+        // 规则体中有谓语为变量的模式时，需要全部六种顺序的 Trie 才能对其做 leapfrog join
+        for (const auto& rule : this->rules) {
             for (const auto& triple : rule.body) {
-                if (triple.predicate == headPredicate) {
-                    isRecursive = true;
-                    break;
+                if (isVariable(triple.predicate)) {
+                    store.enableAllOrders();
                 }
             }
-            if(isRecursive) {
-                recursiveRules.push_back(rule);
-            } else {
-                nonrecursiveRules.push_back(rule);
-            }
         }
 
         initiateRulesMap();
         initiateCounting();
+        for (const std::vector<IdRule>* ruleList : {&this->rules, &recursiveRules, &nonrecursiveRules}) {
+            for (const auto& rule : *ruleList) {
+                rulePlans.emplace(&rule, compileRule(rule));
+            }
+        }
+        planJoins();
     }
+    // 连接计划以规则的地址为键，不能拷贝
+    DatalogEngine(const DatalogEngine&) = delete;
+    DatalogEngine& operator=(const DatalogEngine&) = delete;
+
+    // 半朴素求值：第一轮在显式事实上完整执行每条规则，之后每轮只以上一轮新推出的事实（增量关系）为起点
     void reason();
 
     void reasonNaive();
 
-    void leapfrogDRed(std::vector<Triple>& deletedFacts, std::vector<Triple>& insertedFacts);
+    void leapfrogDRed(std::vector<Triple>& deletedTriples, std::vector<Triple>& insertedTriples);
+
+    void leapfrogDRedCounting(std::vector<Triple>& deletedTriples, std::vector<Triple>& insertedTriples);
+
+    // 在当前事实库上对第 ruleIndex 条规则做一次完整的 leapfrog join，推出的事实追加到 newFacts，不写入事实库
+    // 工作区按线程复用，newFacts 容量足够时不分配内存
+    void evaluateRule(size_t ruleIndex, std::vector<IdTriple>& newFacts) { leapfrogTriejoin(rules[ruleIndex], newFacts); }
+    // 同上，但把最外层变量的键划分为多段交给 scheduler 并行执行，各线程的结果最后追加到 newFacts
+    void evaluateRule(size_t ruleIndex, std::vector<IdTriple>& newFacts, TaskScheduler& scheduler);
+    size_t ruleCount() const { return rules.size(); }
+
+    // 当前的全部显式事实
+    std::vector<IdTriple> getExplicitFacts() const;
 
-    void leapfrogDRedCounting(std::vector<Triple>& deletedFacts, std::vector<Triple>& insertedFacts);
+    // 保存当前事实库（含推理结果）及显式事实的快照，重启后用 openSnapshot 和上面的构造函数恢复
+    bool saveSnapshot(const std::string& path) const {
+        std::vector<IdTriple> explicitFacts = getExplicitFacts();
+        return store.saveSnapshot(path, &explicitFacts);
+    }
+
+    // 之后每次 leapfrogDRed / leapfrogDRedCounting 都先把批次追加到 log，写入失败时不做修改
+    void attachLog(WriteAheadLog* log) { wal = log; }
+    // 重启后在快照之上按顺序重放日志中的批次，按每个批次记录的维护路径增量维护而不是重新推理；
+    // 计数不随快照保存，从快照恢复时计数路径的批次也走 leapfrogDRed
+    bool recover(const WriteAheadLog& log);
+    // 保存快照（先写临时文件再改名），成功后清空已附加的日志
+    bool checkpoint(const std::string& snapshotPath);
 
 private:
     // std::vector<Triple> applyRule(const Rule& rule);
     // bool matchTriple(const Triple& triple, const Triple& pattern, std::map<std::string, std::string>& variableBindings);
     // Triple instantiateTriple(const Triple& triple, const std::map<std::string, std::string>& variableBindings);
-    static bool isVariable(const std::string& str);
+    static bool isVariable(TermId term);
+
+    bool isExplicit(const IdTriple& fact) const;
+    // 在显式事实中记录一批删除/插入
+    void deleteExplicitFacts(const std::vector<IdTriple>& facts);
+    void insertExplicitFacts(const std::vector<IdTriple>& facts);
+    // 一批增量维护发布后调用：把本批增删的显式事实并入 explicitStore，并固定它的新版本作为 explicitBase
+    void rebaseExplicitFacts();
     // std::string getElem(const Triple& triple, int i);
 
-    void initiateRulesMap();
-
-    void initiateCounting();
-
-    void leapfrogTriejoin(TrieNode *psoRoot, TrieNode *posRoot, const Rule &rule,
-                            std::vector<Triple> &newFacts,
-                            std::map<std::string, std::string> &bindings);
-
-    void leapfrogTriejoinBackwards(TrieNode *psoRoot, TrieNode *posRoot, const Rule &rule,
-                                    std::vector<Triple> &newFacts,
-                                    std::map<std::string, std::string> &bindings, Triple &currentTriple);
-
-    void join_by_variable(TrieNode *psoRoot, TrieNode *posRoot, const Rule &rule,
-                          const std::set<std::string> &variables,
-                          const std::map<std::string, std::vector<std::pair<int, int>>> &varPositions,
-                          std::map<std::string, std::string> &bindings, int varIdx, std::vector<Triple> &newFacts);
+    void encodeRules(const std::vector<Rule>& sourceRules);
 
-    static std::string substituteVariable(const std::string &term, const std::map<std::string, std::string> &bindings);
+    std::vector<IdTriple> encodeFacts(const std::vector<Triple>& facts);
 
-    bool checkConflictingTriples(const std::map<std::string, std::string>& bindings,
-                                    const std::map<std::string, std::vector<std::pair<int, int>>>& varPositions,
-                                    const Rule& rule) const;
+    void initiateRulesMap();
 
-    void overdeleteDRed(std::vector<Triple> &overdeletedFacts, std::vector<Triple> deletedFacts);
+    static void indexRules(const std::vector<IdRule>& ruleList, RulesMap& rulesIndex);
 
-    void insertDRed(std::vector<Triple> newFacts, std::vector<Triple> redrivedFacts);
+    static const std::vector<std::pair<size_t, size_t>>& triggersOf(const RulesMap& rulesIndex, TermId predicate);
 
-    void overdeleteDRedCounting(std::vector<Triple> &overdeletedFacts, std::vector<Triple> deletedFacts);
+    void initiateCounting();
 
-    void insertDRedCounting(std::vector<Triple> newFacts, std::vector<Triple> redrivedFacts);
+    // 用 Tarjan 算法求谓语依赖图的强连通分量，填入 strata、ruleStratum、recursiveRules 和 nonrecursiveRules
+    void stratifyRules();
+
+    // 推理过程中的统计，各分层并行时共享
+    struct ReasonStats {
+        std::atomic<size_t> derivations{0}; // join 产生的推导数，含推出已有事实的
+        std::atomic<size_t> skipped{0};     // 半朴素求值避免的重复推导数
+        std::atomic<size_t> iterations{0};  // 各递归分层的半朴素迭代轮数之和
+    };
+    // 调度的单位：一条规则以 delta 的一批为增量模式的关系做 join；pattern 为 NO_TRIGGER 时做完整的 join
+    struct JoinTask {
+        size_t rule;    // 规则在 rules 中的下标
+        size_t pattern;
+        size_t batch;
+    };
+    // 在低层已完成的事实库上求值一个分层：非递归分层只做一轮完整的 join，递归分层再以半朴素迭代到不动点
+    // derived 为本次推理推出的全部新事实，是唯一的去重点
+    void evaluateStratum(const Stratum& stratum, TaskScheduler& scheduler, ConcurrentTripleSet& derived,
+                         ReasonStats& stats);
+    // 把任务交给调度器并等待全部完成；推出的事实中不在事实库、且由本线程首先插入 derived 的，按工作线程写入 outputs
+    void runJoins(TaskScheduler& scheduler, const std::vector<JoinTask>& tasks, const DeltaRelation* delta,
+                  ConcurrentTripleSet& derived, std::vector<std::vector<IdTriple>>& outputs, ReasonStats& stats);
+
+    // 为规则变量分配槽位，各触发方式的计划由 planJoins 填入
+    static RulePlan compileRule(const IdRule& rule);
+    // 为所有规则的各种触发方式计算连接计划
+    void planJoins();
+    // 按变量顺序 order 生成每层的模式访问方式，trigger 为 NO_TRIGGER 以外时 order 开头为触发时已绑定的变量
+    TriggerPlan compileTrigger(const RulePlan& plan, size_t trigger, const std::vector<TermId>& order) const;
+    // 从 trigger 预先绑定的变量出发，每次选择候选值估计最少的变量
+    std::vector<TermId> planVariableOrder(const IdRule& rule, size_t trigger, const std::set<TermId>& derivedPredicates) const;
+    // 已绑定 bound 中的变量时，pattern 中的 variable 的候选值个数估计
+    double estimateCandidates(const IdTriple& pattern, TermId variable, const std::set<TermId>& bound,
+                              const std::set<TermId>& derivedPredicates) const;
+
+    // rule 须为 rules、recursiveRules 或 nonrecursiveRules 中的元素
+    // trigger 不为 NO_TRIGGER 时以 fact 绑定触发模式（或规则头）中的变量，fact 与之不匹配时没有结果
+    // morsel 限定最外层变量的键区间，只对没有预先绑定变量的 join 有意义
+    void leapfrogTriejoin(const IdRule &rule,
+                            std::vector<IdTriple> &newFacts,
+                            size_t trigger = NO_TRIGGER,
+                            const IdTriple &fact = IdTriple(),
+                            const Morsel &morsel = Morsel());
+
+    // 半朴素求值的一次 join：规则体第 pattern 个模式读 delta，之前的模式读完整的事实库（已含 delta），
+    // 之后的模式只匹配旧事实（事实库中不在 delta 里的），这样用到多个增量事实的推导只产生一次；返回因此跳过的推导数
+    // update: 增量模式只读 delta 的第 batch 批，之后的模式仍排除整个 delta
+    size_t leapfrogTriejoinDelta(const IdRule &rule, size_t pattern, const DeltaRelation &delta, size_t batch,
+                                 std::vector<IdTriple> &newFacts, const Morsel &morsel = Morsel());
+
+    // 按批处理触发事实：delta 为一批已加入事实库的触发事实（已建好 Trie），对 ruleList 中可能匹配其中事实的
+    // 每个 (规则, 模式) 以这一批为增量模式各 join 一次，推出的事实追加到 newFacts。
+    // 推出的事实集合与逐个事实触发 join 相同，但用到多个触发事实的推导只产生一次
+    void joinTriggers(const std::vector<IdRule> &ruleList, const RulesMap &rulesIndex, const DeltaRelation &delta,
+                      std::vector<IdTriple> &newFacts);
+
+    // 每个工作线程分到的段数，以及一段至少包含的最外层键数
+    static constexpr size_t MORSELS_PER_THREAD = 4;
+    static constexpr size_t MIN_MORSEL_KEYS = 16;
+    // 按最外层变量在键数最少的模式中的键，把没有预先绑定变量的 join 划分为至多 morselCount 段；调用方持有共享锁
+    std::vector<Morsel> splitFirstLevel(const TriggerPlan &triggerPlan, const DeltaRelation *delta, size_t batch,
+                                        size_t morselCount) const;
+
+    void join_by_variable(const RulePlan &plan, const TriggerPlan &triggerPlan, size_t level,
+                          JoinFrame &frame, std::vector<IdTriple> &newFacts) const;
+
+    static IdTriple instantiate(const PlanPattern &pattern, const TermId *slots);
+
+    void overdeleteDRed(std::vector<IdTriple> &overdeletedFacts, std::vector<IdTriple> deletedFacts);
+
+    void insertDRed(std::vector<IdTriple> newFacts, std::vector<IdTriple> redrivedFacts);
+
+    void overdeleteDRedCounting(std::vector<IdTriple> &overdeletedFacts, std::vector<IdTriple> deletedFacts);
+
+    void insertDRedCounting(std::vector<IdTriple> newFacts, std::vector<IdTriple> redrivedFacts);
 
     /*
     void leapfrogTriejoin(TrieNode* trieRoot, const Rule& rule, std::vector<Triple>& newFacts);
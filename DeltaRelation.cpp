@@ -0,0 +1,90 @@
+#include "DeltaRelation.h"
+
+#include <algorithm>
+
+namespace {
+bool lessPSO(const IdTriple& a, const IdTriple& b) {
+    if (a.predicate != b.predicate)
+        return a.predicate < b.predicate;
+    if (a.subject != b.subject)
+        return a.subject < b.subject;
+    return a.object < b.object;
+}
+}
+
+DeltaRelation::DeltaRelation(const TripleStore& store) {
+    static const TrieOrder allOrders[] = {TrieOrder::PSO, TrieOrder::POS, TrieOrder::SPO,
+                                          TrieOrder::SOP, TrieOrder::OSP, TrieOrder::OPS};
+    for (TrieOrder order : allOrders) {
+        orders[static_cast<int>(order)] = store.getTrieRoot(order) != nullptr;
+    }
+}
+
+size_t DeltaRelation::partition(size_t batchSize) {
+    std::sort(triples.begin(), triples.end(), lessPSO);
+    batchCountValue = (triples.size() + batchSize - 1) / batchSize;
+    while (batches.size() < batchCountValue) {
+        auto batch = std::make_unique<Batch>();
+        for (int order = 0; order < 6; order++) {
+            if (orders[order]) {
+                batch->tries[order] = std::make_unique<Trie>(static_cast<TrieOrder>(order));
+            }
+        }
+        batches.push_back(std::move(batch));
+    }
+    for (size_t i = 0; i < batchCountValue; i++) {
+        batches[i]->begin = i * batchSize;
+        batches[i]->end = std::min(triples.size(), (i + 1) * batchSize);
+    }
+    return batchCountValue;
+}
+
+void DeltaRelation::buildBatch(size_t batch) {
+    Batch& target = *batches[batch];
+    std::vector<IdTriple> batchTriples(triples.begin() + target.begin, triples.begin() + target.end);
+    for (auto& trie : target.tries) {
+        if (trie) {
+            TripleStore::buildTrie(*trie, batchTriples);
+        }
+    }
+}
+
+void DeltaRelation::clear() {
+    triples.clear();
+    tripleSet.clear();
+    for (size_t i = 0; i < batchCountValue; i++) {
+        for (auto& trie : batches[i]->tries) {
+            if (trie) {
+                trie->clear();
+            }
+        }
+    }
+    batchCountValue = 0;
+}
+
+void DeltaRelation::assign(const std::vector<IdTriple>& facts) {
+    clear();
+    for (const auto& fact : facts) {
+        insert(fact);
+    }
+    size_t count = partition();
+    for (size_t batch = 0; batch < count; batch++) {
+        buildBatch(batch);
+    }
+}
+
+bool DeltaRelation::batchContains(size_t batch, const IdTriple& triple) const {
+    const Batch& target = *batches[batch];
+    return std::binary_search(triples.begin() + target.begin, triples.begin() + target.end, triple, lessPSO);
+}
+
+std::vector<TermId> DeltaRelation::getPredicates(size_t batch) const {
+    const Batch& target = *batches[batch];
+    std::vector<TermId> predicates;
+    for (size_t i = target.begin; i < target.end; i++) {
+        if (predicates.empty() || predicates.back() != triples[i].predicate) {
+            predicates.push_back(triples[i].predicate);
+        }
+    }
+    return predicates;
+}
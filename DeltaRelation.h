@@ -0,0 +1,69 @@
+#ifndef RDFPANDA_STORAGE_DELTARELATION_H
+#define RDFPANDA_STORAGE_DELTARELATION_H
+
+#include <memory>
+#include <vector>
+
+#include "Trie.h"
+#include "TripleSet.h"
+#include "TripleStore.h"
+
+// DeltaRelation：半朴素求值中一轮新推出的事实（增量关系）
+// 按事实库维护的各顺序排序后建成 Trie，join 时作为增量模式的 leapfrog 输入；另有哈希集合用于判断事实是否属于本轮
+// update: 按 (谓语, 主语, 宾语) 排序后分成若干批，每批各自建 Trie，一批是并行调度的一个任务单位；
+// 同一谓语的事实集中在相邻的批中。加入事实后先 partition 再对每批 buildBatch，两次 partition 之间 Trie 不变
+class DeltaRelation {
+public:
+    static constexpr size_t BATCH_SIZE = 4096;
+
+    // 维护与 store 当前相同的 Trie 顺序
+    explicit DeltaRelation(const TripleStore& store);
+    DeltaRelation(const DeltaRelation&) = delete;
+    DeltaRelation& operator=(const DeltaRelation&) = delete;
+
+    // 加入事实，原本不存在时返回 true
+    bool insert(const IdTriple& triple) {
+        if (!tripleSet.insert(triple)) {
+            return false;
+        }
+        triples.push_back(triple);
+        return true;
+    }
+    // 对已加入的事实排序并分批，返回批数；之后各批的 buildBatch 可以并行调用
+    size_t partition(size_t batchSize = BATCH_SIZE);
+    void buildBatch(size_t batch);
+    void clear();
+    // 清空后加入 facts，在当前线程分批并建好每批的 Trie，用于单线程的增量维护
+    void assign(const std::vector<IdTriple>& facts);
+
+    bool contains(const IdTriple& triple) const { return tripleSet.contains(triple); }
+    size_t size() const { return triples.size(); }
+    bool empty() const { return triples.empty(); }
+    const std::vector<IdTriple>& getTriples() const { return triples; }
+
+    size_t batchCount() const { return batchCountValue; }
+    // 返回第 batch 批指定顺序的 Trie 根节点，该顺序未维护时返回 nullptr
+    const TrieNode* getTrieRoot(size_t batch, TrieOrder order) const {
+        const auto& trie = batches[batch]->tries[static_cast<int>(order)];
+        return trie ? trie->root : nullptr;
+    }
+    bool batchContains(size_t batch, const IdTriple& triple) const;
+    // 按 ID 升序返回第 batch 批中出现的谓语
+    std::vector<TermId> getPredicates(size_t batch) const;
+
+private:
+    struct Batch {
+        size_t begin = 0; // 在排序后的 triples 中的区间
+        size_t end = 0;
+        std::unique_ptr<Trie> tries[6]; // 下标为 TrieOrder
+    };
+
+    std::vector<IdTriple> triples;
+    TripleSet tripleSet;
+    bool orders[6] = {};
+    std::vector<std::unique_ptr<Batch>> batches; // 可能多于 batchCountValue，多出的留给之后的轮次复用
+    size_t batchCountValue = 0;
+};
+
+
+#endif //RDFPANDA_STORAGE_DELTARELATION_H
@@ -0,0 +1,109 @@
+#include "Dictionary.h"
+
+TermId Dictionary::encode(const std::string& term) {
+    TermId mapped = lookupMapped(term);
+    if (mapped != NONE) {
+        return mapped;
+    }
+    auto it = ids.find(term);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    TermId id = mappedCount + static_cast<TermId>(terms.size());
+    terms.push_back(term);
+    ids.emplace(terms.back(), id);
+    return id;
+}
+
+TermId Dictionary::lookup(const std::string& term) const {
+    TermId mapped = lookupMapped(term);
+    if (mapped != NONE) {
+        return mapped;
+    }
+    auto it = ids.find(term);
+    if (it == ids.end()) {
+        return NONE;
+    }
+    return it->second;
+}
+
+std::string_view Dictionary::decode(TermId id) const {
+    if (isVariable(id)) {
+        return variables[(id & ~VARIABLE_BIT) - 1];
+    }
+    if (id != NONE && id <= mappedCount) {
+        return mappedTerm(id);
+    }
+    return terms[id - mappedCount];
+}
+
+TermId Dictionary::encodeVariable(const std::string& name) {
+    auto it = variableIds.find(name);
+    if (it != variableIds.end()) {
+        return it->second;
+    }
+    variables.push_back(name);
+    TermId id = VARIABLE_BIT | static_cast<TermId>(variables.size());
+    variableIds.emplace(variables.back(), id);
+    return id;
+}
+
+uint64_t Dictionary::termHash(std::string_view term) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : term) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+TermId Dictionary::lookupMapped(std::string_view term) const {
+    if (mappedCount == 0) {
+        return NONE;
+    }
+    for (size_t slot = termHash(term) & mappedTableMask; ; slot = (slot + 1) & mappedTableMask) {
+        TermId id = mappedTable[slot];
+        if (id == NONE) {
+            return NONE;
+        }
+        if (mappedTerm(id) == term) {
+            return id;
+        }
+    }
+}
+
+void Dictionary::exportTerms(std::string& strings, std::vector<uint64_t>& offsets, std::vector<TermId>& table) const {
+    TermId count = static_cast<TermId>(size());
+    strings.clear();
+    offsets.assign(1, 0);
+    offsets.reserve(count + 1);
+    for (TermId id = 1; id <= count; id++) {
+        strings.append(decode(id));
+        offsets.push_back(strings.size());
+    }
+
+    // 装载率不超过 1/2，线性探测的查找长度很短
+    size_t tableSize = 16;
+    while (tableSize < static_cast<size_t>(count) * 2) {
+        tableSize *= 2;
+    }
+    table.assign(tableSize, NONE);
+    for (TermId id = 1; id <= count; id++) {
+        size_t slot = termHash(decode(id)) & (tableSize - 1);
+        while (table[slot] != NONE) {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        table[slot] = id;
+    }
+}
+
+void Dictionary::attachMapped(std::shared_ptr<const void> owner, const char* strings, const uint64_t* offsets,
+                              TermId count, const TermId* table, size_t tableSize) {
+    mappedOwner = std::move(owner);
+    mappedStrings = strings;
+    mappedOffsets = offsets;
+    mappedTable = table;
+    mappedTableMask = tableSize - 1;
+    mappedCount = count;
+}
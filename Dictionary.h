@@ -0,0 +1,81 @@
+#ifndef RDFPANDA_STORAGE_DICTIONARY_H
+#define RDFPANDA_STORAGE_DICTIONARY_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// 所有 RDF 项（IRI、字面量、空白节点）在存储和推理中都以整数 ID 表示
+using TermId = uint32_t;
+
+// Dictionary：RDF 项与稠密整数 ID 之间的双向映射
+// 数据项 ID 从 1 开始连续分配，0 保留为“无效/未绑定”
+// 规则中的变量（如 "?x"）单独编号，并在 ID 最高位打上标记，与数据项互不冲突
+class Dictionary {
+public:
+    static constexpr TermId NONE = 0;
+    static constexpr TermId VARIABLE_BIT = 0x80000000u;
+
+    Dictionary() {
+        terms.emplace_back(); // 占位，对应 NONE
+    }
+    // 字符串视图指向 terms 中的元素，禁止拷贝以免视图悬空（需要共享时使用 shared_ptr）
+    Dictionary(const Dictionary&) = delete;
+    Dictionary& operator=(const Dictionary&) = delete;
+
+    // 返回 term 对应的 ID，若不存在则分配新 ID
+    TermId encode(const std::string& term);
+    // 仅查询，不存在时返回 NONE
+    TermId lookup(const std::string& term) const;
+    // ID -> 字符串，只在输出时调用
+    // 返回视图：来自快照的数据项直接指向映射区，不复制字符串
+    std::string_view decode(TermId id) const;
+
+    // 变量编号：同名变量得到同一 ID
+    TermId encodeVariable(const std::string& name);
+
+    static bool isVariable(TermId id) { return (id & VARIABLE_BIT) != 0; }
+
+    // 数据项数量（不含 NONE 和变量）
+    size_t size() const { return mappedCount + terms.size() - 1; }
+
+    // 快照中的字符串哈希，保存和查找映射区的哈希表都使用它，不能依赖 std::hash 的实现
+    static uint64_t termHash(std::string_view term);
+
+    // 导出全部数据项：strings 为首尾相接的字符串，offsets 为 size() + 1 个分界点，
+    // table 为按 termHash 线性探测的开放寻址表（大小为 2 的幂，0 为空槽）
+    void exportTerms(std::string& strings, std::vector<uint64_t>& offsets, std::vector<TermId>& table) const;
+    // 直接引用快照映射区中由 exportTerms 导出的数据项，作为 ID 1..count；只能在空词典上调用
+    // owner 保证映射区在词典销毁前有效；之后新编码的数据项从 count + 1 开始分配
+    void attachMapped(std::shared_ptr<const void> owner, const char* strings, const uint64_t* offsets,
+                      TermId count, const TermId* table, size_t tableSize);
+
+private:
+    // 快照中的数据项，ID 为 1..mappedCount
+    std::shared_ptr<const void> mappedOwner;
+    const char* mappedStrings = nullptr;
+    const uint64_t* mappedOffsets = nullptr;
+    const TermId* mappedTable = nullptr;
+    size_t mappedTableMask = 0;
+    TermId mappedCount = 0;
+
+    TermId lookupMapped(std::string_view term) const;
+    std::string_view mappedTerm(TermId id) const {
+        return std::string_view(mappedStrings + mappedOffsets[id - 1], mappedOffsets[id] - mappedOffsets[id - 1]);
+    }
+
+    // deque 在尾部追加时不会移动已有元素，因此 ids 的键可以直接引用 terms 中的字符串
+    // ID 为 id 的数据项保存在 terms[id - mappedCount]
+    std::deque<std::string> terms;
+    std::unordered_map<std::string_view, TermId> ids;
+
+    std::deque<std::string> variables;
+    std::unordered_map<std::string_view, TermId> variableIds;
+};
+
+
+#endif //RDFPANDA_STORAGE_DICTIONARY_H
@@ -0,0 +1,152 @@
+#include "PackedKeys.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+namespace {
+uint32_t bitWidth(uint32_t value) {
+    return value == 0 ? 0 : 32 - static_cast<uint32_t>(__builtin_clz(value));
+}
+}
+
+PackedKeys* PackedKeys::pack(const TermId* keys, size_t n, TrieArena& arena) {
+    size_t blockCount = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // 第一遍：确定每块的位宽和数据总长度
+    std::vector<uint32_t> widths(blockCount);
+    size_t totalWords = 0;
+    for (size_t block = 0; block < blockCount; block++) {
+        size_t begin = block * BLOCK_SIZE;
+        size_t end = std::min(n, begin + BLOCK_SIZE);
+        uint32_t maxGap = 0;
+        for (size_t i = begin + 1; i < end; i++) {
+            maxGap = std::max(maxGap, keys[i] - keys[i - 1] - 1);
+        }
+        widths[block] = bitWidth(maxGap);
+        totalWords += wordCount(end - begin, widths[block]);
+    }
+    if (n == 0 || n > UINT32_MAX || totalWords > MAX_WORDS) {
+        return nullptr;
+    }
+
+    size_t bytes = sizeof(PackedKeys) + blockCount * sizeof(BlockHeader) + totalWords * sizeof(uint32_t);
+    auto* packed = new (arena.allocate(bytes)) PackedKeys();
+    packed->count = static_cast<uint32_t>(n);
+
+    uint32_t* words = packed->words();
+    std::fill(words, words + totalWords, 0);
+    size_t wordOffset = 0;
+    for (size_t block = 0; block < blockCount; block++) {
+        size_t begin = block * BLOCK_SIZE;
+        size_t end = std::min(n, begin + BLOCK_SIZE);
+        uint32_t bits = widths[block];
+        BlockHeader& header = packed->headers()[block];
+        header.first = keys[begin];
+        header.offset = static_cast<uint32_t>(wordOffset);
+        header.bits = bits;
+        if (bits != 0) {
+            uint64_t bitPos = 0;
+            for (size_t i = begin + 1; i < end; i++) {
+                uint64_t gap = keys[i] - keys[i - 1] - 1;
+                size_t word = wordOffset + bitPos / 32;
+                uint32_t shift = bitPos % 32;
+                words[word] |= static_cast<uint32_t>(gap << shift);
+                if (shift + bits > 32) {
+                    words[word + 1] |= static_cast<uint32_t>(gap >> (32 - shift));
+                }
+                bitPos += bits;
+            }
+        }
+        wordOffset += wordCount(end - begin, bits);
+    }
+    return packed;
+}
+
+void PackedKeys::release(PackedKeys* packed, TrieArena& arena) {
+    if (packed != nullptr) {
+        arena.deallocate(packed, packed->bytes());
+    }
+}
+
+size_t PackedKeys::bytes() const {
+    size_t blocks = blockCount();
+    size_t totalWords = 0;
+    if (blocks != 0) {
+        const BlockHeader& last = headers()[blocks - 1];
+        totalWords = last.offset + wordCount(blockLength(blocks - 1), last.bits);
+    }
+    return sizeof(PackedKeys) + blocks * sizeof(BlockHeader) + totalWords * sizeof(uint32_t);
+}
+
+void PackedKeys::decodeBlock(size_t block, TermId* out) const {
+    const BlockHeader& header = headers()[block];
+    size_t length = blockLength(block);
+    uint32_t bits = header.bits;
+    TermId value = header.first;
+    out[0] = value;
+    if (bits == 0) {
+        for (size_t i = 1; i < length; i++) {
+            out[i] = ++value;
+        }
+        return;
+    }
+    const uint32_t* data = words() + header.offset;
+    const uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+    uint64_t bitPos = 0;
+    for (size_t i = 1; i < length; i++) {
+        size_t word = bitPos / 32;
+        uint32_t shift = bitPos % 32;
+        uint64_t window = data[word];
+        if (shift + bits > 32) {
+            window |= static_cast<uint64_t>(data[word + 1]) << 32;
+        }
+        value += static_cast<TermId>((window >> shift) & mask) + 1;
+        out[i] = value;
+        bitPos += bits;
+    }
+}
+
+size_t PackedKeys::findBlock(TermId key, size_t fromBlock) const {
+    const BlockHeader* header = headers();
+    size_t blocks = blockCount();
+    size_t lo = fromBlock;
+    size_t step = 1;
+    while (lo + step < blocks && header[lo + step].first <= key) {
+        lo += step;
+        step <<= 1;
+    }
+    // header[lo].first <= key（或 lo == fromBlock），header[hi].first > key
+    size_t hi = std::min(lo + step, blocks);
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (header[mid].first <= key) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t PackedKeys::find(TermId key) const {
+    if (count == 0 || key < headers()[0].first) {
+        return count;
+    }
+    size_t block = findBlock(key, 0);
+    TermId buffer[BLOCK_SIZE];
+    decodeBlock(block, buffer);
+    size_t length = blockLength(block);
+    TermId* it = std::lower_bound(buffer, buffer + length, key);
+    if (it == buffer + length || *it != key) {
+        return count;
+    }
+    return block * BLOCK_SIZE + (it - buffer);
+}
+
+void PackedKeys::decodeAll(TermId* out) const {
+    size_t blocks = blockCount();
+    for (size_t block = 0; block < blocks; block++) {
+        decodeBlock(block, out + block * BLOCK_SIZE);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef RDFPANDA_STORAGE_PACKEDKEYS_H
+#define RDFPANDA_STORAGE_PACKEDKEYS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Dictionary.h"
+#include "TrieArena.h"
+
+// PackedKeys：Trie 叶层有序键数组的压缩表示
+// 键按 BLOCK_SIZE 个一块，8 字节的块头保存块首键、位宽和数据在 words 中的位置；块内其余键保存与前一个键的差值减 1，
+// 按块内最大值的位宽紧密排列（连续的 ID 位宽为 0，不占空间）。
+// 查找和 seek 先在块首键上二分/指数探测定位到块，再只解码这一块，因此不需要解压整个数组
+// 整个对象连同块头和数据在 arena 中一次分配，创建后不可修改
+class PackedKeys {
+public:
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    static constexpr uint32_t MAX_WORDS = (1u << 26) - 1;
+
+    struct BlockHeader {
+        TermId first;          // 块首键
+        uint32_t offset : 26;  // 块数据在 words 中的起始下标
+        uint32_t bits : 6;     // 块内差值的位宽
+    };
+
+    // 压缩 n 个严格递增的键，数据超过 MAX_WORDS 个字时不压缩，返回 nullptr
+    static PackedKeys* pack(const TermId* keys, size_t n, TrieArena& arena);
+    static void release(PackedKeys* packed, TrieArena& arena);
+
+    size_t size() const { return count; }
+    size_t blockCount() const { return (count + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+    // 对象连同块头和数据的总字节数
+    size_t bytes() const;
+    TermId blockFirst(size_t block) const { return headers()[block].first; }
+    // 第 block 块中的键数
+    size_t blockLength(size_t block) const {
+        return block + 1 < blockCount() ? BLOCK_SIZE : count - block * BLOCK_SIZE;
+    }
+
+    // 解码第 block 块到 out（至少 BLOCK_SIZE 个元素）
+    void decodeBlock(size_t block, TermId* out) const;
+    // 返回最后一个块首键不大于 key 的块，从 fromBlock 开始向后指数探测；所有块首键都大于 key 时返回 fromBlock
+    size_t findBlock(TermId key, size_t fromBlock) const;
+    // 返回 key 的下标，不存在时返回 size()
+    size_t find(TermId key) const;
+    // 解压全部键到 out（至少 size() 个元素）
+    void decodeAll(TermId* out) const;
+
+private:
+    uint32_t count = 0;
+
+    static size_t wordCount(size_t length, uint32_t bits) { return ((length - 1) * bits + 31) / 32; }
+    const BlockHeader* headers() const { return reinterpret_cast<const BlockHeader*>(this + 1); }
+    BlockHeader* headers() { return reinterpret_cast<BlockHeader*>(this + 1); }
+    const uint32_t* words() const { return reinterpret_cast<const uint32_t*>(headers() + blockCount()); }
+    uint32_t* words() { return reinterpret_cast<uint32_t*>(headers() + blockCount()); }
+};
+
+
+#endif //RDFPANDA_STORAGE_PACKEDKEYS_H
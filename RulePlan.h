@@ -0,0 +1,98 @@
+#ifndef RDFPANDA_STORAGE_RULEPLAN_H
+#define RDFPANDA_STORAGE_RULEPLAN_H
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "Trie.h"
+
+class DeltaRelation;
+
+// RulePlan：编译后的规则，由 DatalogEngine 在构造时生成，推理过程中只读
+// 规则中的变量编号为连续的槽位，join 时变量的绑定值保存在按槽位下标的数组中，不再查 map
+
+// 规则中的一个位置：变量的槽位，或常量
+struct PlanTerm {
+    int slot = -1;                         // 变量的槽位，常量为 -1
+    TermId constant = Dictionary::NONE;
+
+    bool isVariable() const { return slot >= 0; }
+    TermId value(const TermId* slots) const { return slot >= 0 ? slots[slot] : constant; }
+};
+
+using PlanPattern = std::array<PlanTerm, 3>; // 主语、谓语、宾语
+
+// 在某一层为变量打开一个模式：沿 order 顺序的 Trie 逐层 seek 前缀，到达变量所在的层
+struct PatternAccess {
+    int pattern = 0;        // 模式在规则体中的下标
+    TrieOrder order = TrieOrder::PSO;
+    int prefixLength = 0;   // 前缀层数，即模式中已绑定的位置数
+    PlanTerm prefix[2];     // 各层前缀的值
+    bool delta = false;     // 在增量关系的 Trie 上打开（半朴素求值的增量模式）
+};
+
+// join 的一层：绑定一个变量，对所有含它的模式做 leapfrog 交集
+struct JoinLevel {
+    int slot = 0;
+    std::vector<PatternAccess> accesses; // 没有可用索引顺序的模式不在其中，留给最终检查
+    size_t firstIterator = 0;            // 本层的迭代器在 JoinFrame 中的起始下标
+};
+
+// 一种触发方式（见 DatalogEngine::NO_TRIGGER 等）下的执行计划
+struct TriggerPlan {
+    std::vector<JoinLevel> levels;     // 按连接计划的顺序绑定触发时尚未绑定的变量
+    std::vector<int> checkedPatterns;  // 触发绑定后已完全确定的模式（含触发模式本身），join 前先检查是否存在
+    std::vector<int> verifiedPatterns; // 所有变量绑定后仍需检查是否存在的模式，其余模式已由前缀完整的叶层迭代器保证
+    size_t iteratorCount = 0;          // 各层迭代器数之和
+    // 半朴素求值：deltaPattern 读增量关系，oldPatterns（其后的模式）只匹配不在增量关系中的旧事实
+    int deltaPattern = -1;
+    std::vector<int> oldPatterns;
+};
+
+// 最外层变量的键区间 [begin, end)，把一次 join 拆成多段并行执行；为 NONE 的一侧没有限制
+struct Morsel {
+    TermId begin = Dictionary::NONE;
+    TermId end = Dictionary::NONE;
+};
+
+struct RulePlan {
+    std::vector<TermId> variables;     // 槽位 -> 变量 ID
+    std::vector<PlanPattern> body;
+    PlanPattern head;
+    // 下标为触发模式在规则体中的下标，body.size() 为规则头触发，body.size() + 1 为无触发
+    std::vector<TriggerPlan> triggers;
+    // 下标为增量模式在规则体中的下标，没有预先绑定的变量
+    std::vector<TriggerPlan> deltas;
+};
+
+// JoinFrame：执行 join 的工作区，每个线程一份，只在遇到更大的规则时扩容
+// 各层的迭代器按 JoinLevel::firstIterator 存放在同一个数组中，稳定后执行 join 不再分配内存
+struct JoinFrame {
+    std::vector<TermId> slots;
+    std::vector<TrieIterator> iterators;
+    std::vector<TrieIterator*> iteratorPointers;
+    const DeltaRelation* delta = nullptr; // 半朴素求值时增量模式读取的关系
+    size_t deltaBatch = 0;                // 增量模式只读 delta 中的这一批
+    size_t skippedDerivations = 0;        // 因 oldPatterns 中的模式落在增量关系中而跳过的推导
+    Morsel morsel;                        // 最外层变量只取这一段的键
+
+    void prepare(const RulePlan& plan, const TriggerPlan& triggerPlan) {
+        if (slots.size() < plan.variables.size()) {
+            slots.resize(plan.variables.size());
+        }
+        if (iterators.size() < triggerPlan.iteratorCount) {
+            iterators.resize(triggerPlan.iteratorCount);
+            iteratorPointers.resize(triggerPlan.iteratorCount);
+        }
+        // 未绑定的槽位保留变量本身的 ID，规则头中只出现在头部的变量原样输出
+        std::copy(plan.variables.begin(), plan.variables.end(), slots.begin());
+        delta = nullptr;
+        deltaBatch = 0;
+        morsel = Morsel();
+        skippedDerivations = 0;
+    }
+};
+
+
+#endif //RDFPANDA_STORAGE_RULEPLAN_H
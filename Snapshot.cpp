@@ -0,0 +1,144 @@
+#include "Snapshot.h"
+
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <cstdio>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr uint64_t SNAPSHOT_MAGIC = 0x50414e5350464452ULL; // "RDFPSNAP"
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr uint64_t PAGE_SIZE_BYTES = 4096;
+
+struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t sectionCount;
+    uint32_t reserved;
+    uint64_t offsets[SNAPSHOT_SECTION_COUNT];
+    uint64_t lengths[SNAPSHOT_SECTION_COUNT];
+};
+static_assert(sizeof(SnapshotHeader) <= PAGE_SIZE_BYTES, "snapshot header must fit in the first page");
+
+uint64_t alignToPage(uint64_t offset) {
+    return (offset + PAGE_SIZE_BYTES - 1) / PAGE_SIZE_BYTES * PAGE_SIZE_BYTES;
+}
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& path) : file(path, std::ios::binary | std::ios::trunc) {
+    // 第 0 页留给文件头
+    std::vector<char> zeros(PAGE_SIZE_BYTES, 0);
+    file.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+}
+
+void SnapshotWriter::addSection(const void* data, size_t bytes) {
+    uint64_t offset = static_cast<uint64_t>(file.tellp());
+    offsets[sectionCount] = offset;
+    lengths[sectionCount] = bytes;
+    sectionCount++;
+    if (bytes > 0) {
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    }
+    // 补零到页边界，下一个段从新页开始
+    uint64_t padding = alignToPage(offset + bytes) - (offset + bytes);
+    static const char zeros[PAGE_SIZE_BYTES] = {};
+    file.write(zeros, static_cast<std::streamsize>(padding));
+}
+
+bool SnapshotWriter::finish(uint32_t flags) {
+    if (sectionCount != SNAPSHOT_SECTION_COUNT) {
+        return false;
+    }
+    SnapshotHeader header = {};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.flags = flags;
+    header.sectionCount = sectionCount;
+    std::memcpy(header.offsets, offsets, sizeof(offsets));
+    std::memcpy(header.lengths, lengths, sizeof(lengths));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.flush();
+    return file.good();
+}
+
+std::shared_ptr<MappedSnapshot> MappedSnapshot::open(const std::string& path) {
+    std::shared_ptr<MappedSnapshot> snapshot(new MappedSnapshot());
+#ifdef _WIN32
+    // 没有 mmap 时退化为一次性读入内存，访问方式不变
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    if (size <= 0) {
+        std::fclose(file);
+        return nullptr;
+    }
+    char* buffer = new char[size];
+    size_t read = std::fread(buffer, 1, static_cast<size_t>(size), file);
+    std::fclose(file);
+    snapshot->base = buffer;
+    snapshot->length = static_cast<size_t>(size);
+    if (read != snapshot->length) {
+        return nullptr;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info = {};
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        return nullptr;
+    }
+    snapshot->base = static_cast<const char*>(address);
+    snapshot->length = static_cast<size_t>(info.st_size);
+#endif
+
+    if (snapshot->length < sizeof(SnapshotHeader)) {
+        return nullptr;
+    }
+    SnapshotHeader header;
+    std::memcpy(&header, snapshot->base, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.sectionCount != SNAPSHOT_SECTION_COUNT) {
+        return nullptr;
+    }
+    for (uint32_t i = 0; i < SNAPSHOT_SECTION_COUNT; i++) {
+        if (header.offsets[i] % PAGE_SIZE_BYTES != 0 || header.offsets[i] + header.lengths[i] > snapshot->length) {
+            return nullptr;
+        }
+    }
+    snapshot->fileFlags = header.flags;
+    std::memcpy(snapshot->offsets, header.offsets, sizeof(header.offsets));
+    std::memcpy(snapshot->lengths, header.lengths, sizeof(header.lengths));
+    return snapshot;
+}
+
+MappedSnapshot::~MappedSnapshot() {
+    if (base == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    delete[] base;
+#else
+    munmap(const_cast<char*>(base), length);
+#endif
+}
@@ -0,0 +1,82 @@
+#ifndef RDFPANDA_STORAGE_SNAPSHOT_H
+#define RDFPANDA_STORAGE_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+// 快照文件格式：
+// 第 0 页为文件头（魔数、版本、标志位、段表），之后每个段都从页边界开始，
+// 因此整个文件可以只读 mmap 后直接按数组访问，不需要反序列化。所有整数均为本机字节序
+enum SnapshotSection : uint32_t {
+    DICT_STRINGS,   // 所有数据项字符串首尾相接
+    DICT_OFFSETS,   // uint64[n + 1]，ID 为 i 的数据项位于 [offsets[i - 1], offsets[i])
+    DICT_TABLE,     // TermId[2 的幂]，按 Dictionary::termHash 线性探测的哈希表，0 为空槽
+    PSO_KEYS0,      // Trie 第 0 层键
+    PSO_STARTS0,    // uint32[n0 + 1]，第 0 层第 i 个键的子节点键在第 1 层中的区间
+    PSO_KEYS1,
+    PSO_STARTS1,
+    PSO_KEYS2,      // 叶层键
+    POS_KEYS0,
+    POS_STARTS0,
+    POS_KEYS1,
+    POS_STARTS1,
+    POS_KEYS2,
+    EXPLICIT_FACTS, // IdTriple[]，推理前的显式事实，仅在设置了 SNAPSHOT_HAS_EXPLICIT_FACTS 时有意义
+    SNAPSHOT_SECTION_COUNT
+};
+
+// 快照中的三元组已包含推理结果，EXPLICIT_FACTS 段保存了对应的显式事实
+constexpr uint32_t SNAPSHOT_HAS_EXPLICIT_FACTS = 1u;
+
+// SnapshotWriter：按段写出快照文件，先写各段，最后回到文件头写段表
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+
+    bool good() const { return file.good(); }
+    // 追加下一个段（按 SnapshotSection 的顺序调用），段起始位置按页对齐
+    void addSection(const void* data, size_t bytes);
+    bool finish(uint32_t flags);
+
+private:
+    std::ofstream file;
+    uint32_t sectionCount = 0;
+    uint64_t offsets[SNAPSHOT_SECTION_COUNT] = {};
+    uint64_t lengths[SNAPSHOT_SECTION_COUNT] = {};
+};
+
+// MappedSnapshot：只读映射的快照文件，析构时解除映射
+// 存储和词典通过 shared_ptr 持有它，引用映射区的数组在它们销毁前一直有效
+class MappedSnapshot {
+public:
+    // 映射并校验快照文件，失败时返回 nullptr
+    static std::shared_ptr<MappedSnapshot> open(const std::string& path);
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+    ~MappedSnapshot();
+
+    uint32_t flags() const { return fileFlags; }
+
+    // 返回段的起始地址，count 为按 T 计的元素个数
+    template <typename T>
+    const T* section(SnapshotSection id, size_t& count) const {
+        count = lengths[id] / sizeof(T);
+        return reinterpret_cast<const T*>(base + offsets[id]);
+    }
+
+private:
+    MappedSnapshot() = default;
+
+    const char* base = nullptr;
+    size_t length = 0;
+    uint32_t fileFlags = 0;
+    uint64_t offsets[SNAPSHOT_SECTION_COUNT] = {};
+    uint64_t lengths[SNAPSHOT_SECTION_COUNT] = {};
+};
+
+
+#endif //RDFPANDA_STORAGE_SNAPSHOT_H
@@ -0,0 +1,97 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+namespace {
+// 当前线程在所属调度器中的编号，不是工作线程时为 SIZE_MAX
+thread_local const TaskScheduler* currentScheduler = nullptr;
+thread_local size_t currentWorker = SIZE_MAX;
+}
+
+TaskScheduler::TaskScheduler(size_t threadCount) {
+    threadCount = std::max<size_t>(1, threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        threads.emplace_back(&TaskScheduler::run, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void TaskScheduler::submit(TaskGroup& group, Task task) {
+    group.pending++;
+    {
+        // 与休眠线程检查条件互斥，避免在其检查之后、休眠之前通知而丢失唤醒；
+        // 先计数再入队，queued 不会因任务被立即取走而减到负数
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+    }
+    size_t id = currentScheduler == this ? currentWorker : nextWorker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[id]->mutex);
+        workers[id]->tasks.push_back({std::move(task), &group});
+    }
+    wakeUp.notify_one();
+}
+
+void TaskScheduler::wait(TaskGroup& group) {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    finished.wait(lock, [&] { return group.pending == 0; });
+}
+
+bool TaskScheduler::take(size_t id, Entry& entry) {
+    {
+        Worker& own = *workers[id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            entry = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < workers.size(); offset++) {
+        Worker& victim = *workers[(id + offset) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            entry = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::run(size_t id) {
+    currentScheduler = this;
+    currentWorker = id;
+    Entry entry;
+    while (true) {
+        if (take(id, entry)) {
+            queued--;
+            entry.task(id);
+            entry.task = nullptr;
+            if (--entry.group->pending == 0) {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                finished.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        // 队列中还有任务（被其他线程取走前短暂可见）时重新尝试，否则休眠到有新任务
+        wakeUp.wait(lock, [&] { return queued != 0 || stopping; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
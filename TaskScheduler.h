@@ -0,0 +1,63 @@
+#ifndef RDFPANDA_STORAGE_TASKSCHEDULER_H
+#define RDFPANDA_STORAGE_TASKSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// TaskScheduler：工作窃取的线程池
+// 每个工作线程有自己的双端队列：工作线程提交的任务放入自己队列的尾部并从尾部取（后进先出，缓存局部性好），
+// 其他线程提交的任务轮流分到各队列；自己的队列为空时从其他队列的头部窃取。
+// 没有可执行的任务时工作线程在条件变量上休眠，不自旋
+// 任务属于一个 TaskGroup，组内未完成的任务数（含执行中新提交的）归零时唤醒等待该组的线程，以此判断一轮计算结束
+class TaskScheduler {
+public:
+    using Task = std::function<void(size_t)>; // 参数为执行任务的工作线程编号，0 .. threadCount() - 1
+
+    struct TaskGroup {
+        std::atomic<size_t> pending{0};
+    };
+
+    explicit TaskScheduler(size_t threadCount = std::thread::hardware_concurrency());
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+    // 等待已提交的任务执行完后结束工作线程
+    ~TaskScheduler();
+
+    void submit(TaskGroup& group, Task task);
+    // 等待 group 中的任务全部完成；不能在工作线程中调用
+    void wait(TaskGroup& group);
+    size_t threadCount() const { return threads.size(); }
+
+private:
+    struct Entry {
+        Task task;
+        TaskGroup* group;
+    };
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Entry> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{0};     // 所有队列中尚未被取走的任务数
+    std::atomic<size_t> nextWorker{0}; // 外部线程提交时轮流选择的队列
+    std::mutex sleepMutex;             // 保护休眠和等待组完成的条件
+    std::condition_variable wakeUp;    // 有新任务或需要结束
+    std::condition_variable finished;  // 某个组的任务全部完成
+    bool stopping = false;
+
+    void run(size_t id);
+    // 先从自己队列的尾部取，再从其他队列的头部窃取
+    bool take(size_t id, Entry& entry);
+};
+
+
+#endif //RDFPANDA_STORAGE_TASKSCHEDULER_H
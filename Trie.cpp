@@ -1,118 +1,482 @@
 #include "Trie.h"
 
-// 插入时采用 PSO 顺序：先插入 predicate，再 subject，最后 object
-void Trie::insertPSO(const Triple& triple) {
-    TrieNode* curr = root;
-    // 顺序：predicate, subject, object
-    std::vector<std::string> keys = { triple.predicate, triple.subject, triple.object };
-    for (const auto & key : keys) {
-        if (curr->children.find(key) == curr->children.end()) {
-            curr->children[key] = new TrieNode();
+#include <future>
+#include <new>
+#include <thread>
+
+TrieNode* TrieNode::create(TrieArena& arena) {
+    return new (arena.allocate(sizeof(TrieNode))) TrieNode();
+}
+
+void TrieNode::destroy(TrieNode* node, TrieArena& arena) {
+    if (node->packed() != nullptr) {
+        PackedKeys::release(node->packedLeaf, arena);
+    } else {
+        for (auto child : node->children) {
+            destroy(child, arena);
+        }
+        node->keys.release(arena);
+        node->children.release(arena);
+    }
+    node->~TrieNode();
+    arena.deallocate(node, sizeof(TrieNode));
+}
+
+TrieNode* TrieNode::getOrCreateChild(TermId key, TrieArena& arena) {
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    size_t idx = it - keys.begin();
+    if (it != keys.end() && *it == key) {
+        return children[idx];
+    }
+    keys.insert(idx, key, arena);
+    TrieNode* child = create(arena);
+    children.insert(idx, child, arena);
+    return child;
+}
+
+size_t TrieNode::insertChild(TermId key, TrieNode* child, TrieArena& arena) {
+    size_t idx = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+    keys.insert(idx, key, arena);
+    children.insert(idx, child, arena);
+    return idx;
+}
+
+void TrieNode::detachChild(size_t idx, TrieArena& arena) {
+    keys.erase(idx, arena);
+    children.erase(idx, arena);
+    if (keys.empty()) {
+        keys.release(arena);
+        children.release(arena);
+    }
+}
+
+void TrieNode::appendKeys(std::vector<TermId>& out) const {
+    if (const PackedKeys* leaf = packed()) {
+        size_t offset = out.size();
+        out.resize(offset + leaf->size());
+        leaf->decodeAll(out.data() + offset);
+    } else {
+        out.insert(out.end(), keys.begin(), keys.end());
+    }
+}
+
+bool TrieNode::pack(TrieArena& arena) {
+    // 借用快照映射区的键数组不占 arena 内存，压缩只会增加占用
+    if (keys.empty() || !children.empty() || keys.borrowed()) {
+        return false;
+    }
+    PackedKeys* result = PackedKeys::pack(keys.data(), keys.size(), arena);
+    if (result == nullptr) {
+        return false;
+    }
+    if (TrieArena::allocationSize(result->bytes()) >= keys.allocatedBytes()) {
+        PackedKeys::release(result, arena);
+        return false;
+    }
+    keys.release(arena);
+    packedLeaf = result;
+    keys.setTagged(true);
+    return true;
+}
+
+void TrieNode::unpack(TrieArena& arena) {
+    if (!keys.tagged()) {
+        return;
+    }
+    PackedKeys* leaf = packedLeaf;
+    std::vector<TermId> values;
+    appendKeys(values);
+    PackedKeys::release(leaf, arena);
+    new (&children) ArenaArray<TrieNode*>();
+    keys.setTagged(false);
+    keys.assign(values.data(), values.size(), arena);
+}
+
+bool TrieNode::insertKey(TermId key, TrieArena& arena) {
+    unpack(arena);
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it != keys.end() && *it == key) {
+        return false;
+    }
+    keys.insert(it - keys.begin(), key, arena);
+    return true;
+}
+
+bool TrieNode::eraseKey(TermId key, TrieArena& arena) {
+    unpack(arena);
+    size_t idx = find(key);
+    if (idx == keys.size()) {
+        return false;
+    }
+    keys.erase(idx, arena);
+    if (idx < children.size()) {
+        destroy(children[idx], arena);
+        children.erase(idx, arena);
+    }
+    if (keys.empty()) {
+        keys.release(arena);
+        children.release(arena);
+    }
+    return true;
+}
+
+Trie::Trie(const Trie& other) : order(other.order), partitioned(other.partitioned) {
+    if (!partitioned) {
+        root = cloneNode(other.root, arena);
+        return;
+    }
+    root = TrieNode::create(arena);
+    for (size_t i = 0; i < other.root->keys.size(); i++) {
+        auto partition = std::make_unique<Partition>();
+        partition->size = other.partitions[i]->size;
+        root->insertChild(other.root->keys[i], cloneNode(other.root->children[i], partition->arena), arena);
+        partition->fanouts = other.partitions[i]->fanouts;
+        partitions.push_back(std::move(partition));
+    }
+}
+
+TrieNode* Trie::cloneNode(const TrieNode* node, TrieArena& target) {
+    TrieNode* copy = TrieNode::create(target);
+    if (node->packed() != nullptr) {
+        std::vector<TermId> values;
+        node->appendKeys(values);
+        copy->keys.assign(values.data(), values.size(), target);
+        copy->pack(target);
+        return copy;
+    }
+    copy->keys.assign(node->keys.data(), node->keys.size(), target);
+    if (!node->children.empty()) {
+        copy->children.assign(node->children.data(), node->children.size(), target);
+        for (size_t i = 0; i < node->children.size(); i++) {
+            copy->children[i] = cloneNode(node->children[i], target);
+        }
+    }
+    return copy;
+}
+
+size_t Trie::addFirst(TermId first) {
+    if (!partitioned) {
+        return root->insertChild(first, TrieNode::create(arena), arena);
+    }
+    auto partition = std::make_unique<Partition>();
+    size_t idx = root->insertChild(first, TrieNode::create(partition->arena), arena);
+    partitions.insert(partitions.begin() + idx, std::move(partition));
+    return idx;
+}
+
+void Trie::removeFirst(size_t idx) {
+    if (!partitioned) {
+        root->eraseKey(root->keys[idx], arena);
+        return;
+    }
+    // 子树的全部内存都在分区的 arena 中，随分区一起释放
+    root->detachChild(idx, arena);
+    partitions.erase(partitions.begin() + idx);
+}
+
+void Trie::insert(TermId first, TermId second, TermId third) {
+    size_t idx = root->find(first);
+    if (idx == root->keys.size()) {
+        idx = addFirst(first);
+    }
+    TrieArena& subtree = subtreeArena(idx);
+    TrieNode* curr = root->children[idx]->getOrCreateChild(second, subtree);
+    size_t fanout = curr->keyCount();
+    if (curr->insertKey(third, subtree) && partitioned) {
+        partitions[idx]->size++;
+        partitions[idx]->moveFanout(fanout, fanout + 1);
+    }
+}
+
+void Trie::erase(TermId first, TermId second, TermId third) {
+    size_t idx = root->find(first);
+    if (idx == root->keys.size()) {
+        return; // 如果找不到对应的路径，直接返回
+    }
+    TrieArena& subtree = subtreeArena(idx);
+    TrieNode* firstNode = root->children[idx];
+    TrieNode* secondNode = firstNode->findChild(second);
+    if (secondNode == nullptr) {
+        return;
+    }
+    if (!secondNode->eraseKey(third, subtree)) {
+        return;
+    }
+    if (partitioned) {
+        size_t fanout = secondNode->keyCount();
+        partitions[idx]->size--;
+        partitions[idx]->moveFanout(fanout + 1, fanout);
+    }
+    // 自底向上删除已经没有子键的节点，避免迭代器遍历到空分支
+    if (secondNode->keys.empty()) {
+        firstNode->eraseKey(second, subtree);
+        if (firstNode->keys.empty()) {
+            removeFirst(idx);
         }
-        curr = curr->children[key];
     }
-    curr->isEnd = true;
 }
 
-// 插入时采用 POS 顺序：先插入 predicate，再 object，最后 subject
-void Trie::insertPOS(const Triple &triple) {
-    TrieNode* curr = root;
-    // 顺序：predicate, object, subject
-    std::vector<std::string> keys = { triple.predicate, triple.object, triple.subject };
-    for (const auto & key : keys) {
-        if (curr->children.find(key) == curr->children.end()) {
-            curr->children[key] = new TrieNode();
+TrieNode* Trie::find(TermId first, TermId second, TermId third) const {
+    TrieNode* firstNode = root->findChild(first);
+    if (firstNode == nullptr) {
+        return nullptr;
+    }
+    TrieNode* secondNode = firstNode->findChild(second);
+    if (secondNode == nullptr || secondNode->find(third) == secondNode->keyCount()) {
+        return nullptr;
+    }
+    return secondNode;
+}
+
+size_t Trie::countFirst(TermId first) const {
+    size_t idx = root->find(first);
+    if (idx == root->keys.size()) {
+        return 0;
+    }
+    if (partitioned) {
+        return partitions[idx]->size;
+    }
+    size_t count = 0;
+    for (const TrieNode* second : root->children[idx]->children) {
+        count += second->keyCount();
+    }
+    return count;
+}
+
+bool Trie::fanoutStats(TermId first, FanoutStats& stats) const {
+    size_t idx = root->find(first);
+    if (idx == root->keys.size()) {
+        return false;
+    }
+    std::map<uint32_t, uint32_t> scanned;
+    if (!partitioned) {
+        for (const TrieNode* second : root->children[idx]->children) {
+            scanned[static_cast<uint32_t>(second->keyCount())]++;
         }
-        curr = curr->children[key];
     }
-    curr->isEnd = true;
+    const std::map<uint32_t, uint32_t>& fanouts = partitioned ? partitions[idx]->fanouts : scanned;
+    stats = FanoutStats();
+    size_t total = 0;
+    for (const auto& [fanout, count] : fanouts) {
+        size_t bucket = 31 - static_cast<size_t>(__builtin_clz(fanout));
+        if (stats.histogram.size() <= bucket) {
+            stats.histogram.resize(bucket + 1, 0);
+        }
+        stats.histogram[bucket] += count;
+        stats.distinct += count;
+        total += static_cast<size_t>(fanout) * count;
+    }
+    stats.max = fanouts.empty() ? 0 : fanouts.rbegin()->first;
+    stats.average = stats.distinct == 0 ? 0 : static_cast<double>(total) / static_cast<double>(stats.distinct);
+    return true;
 }
 
-void Trie::deletePSO(const Triple& triple) {
-    // 删除 PSO 顺序的三元组
-    TrieNode* curr = root;
-    TrieNode* parent = nullptr;
-    std::vector<std::string> keys = { triple.predicate, triple.subject, triple.object };
-    for (const auto & key : keys) {
-        if (curr->children.find(key) == curr->children.end()) {
-            return; // 如果找不到对应的路径，直接返回
+void Trie::Partition::moveFanout(size_t from, size_t to) {
+    if (from != 0) {
+        auto it = fanouts.find(static_cast<uint32_t>(from));
+        if (--it->second == 0) {
+            fanouts.erase(it);
         }
-        parent = curr; // 记录上一个节点
-        curr = curr->children[key];
+    }
+    if (to != 0) {
+        fanouts[static_cast<uint32_t>(to)]++;
+    }
+}
+
+void Trie::Partition::recount(const TrieNode* first) {
+    size = 0;
+    fanouts.clear();
+    for (const TrieNode* second : first->children) {
+        size_t fanout = second->keyCount();
+        size += fanout;
+        fanouts[static_cast<uint32_t>(fanout)]++;
+    }
+}
+
+ArenaStats Trie::allocationStats() const {
+    ArenaStats stats = arena.stats();
+    for (const auto& partition : partitions) {
+        stats += partition->arena.stats();
+    }
+    return stats;
+}
 
+void Trie::clear() {
+    if (partitioned) {
+        root->keys.release(arena);
+        root->children.release(arena);
+        partitions.clear();
+        return;
     }
-    if (curr->isEnd) {
-        curr->isEnd = false; // 仅标记为非结束节点，不删除节点
-        // 如果当前节点没有子节点且不是结束节点，删除当前节点
-        if (curr->children.empty()) {
-            parent->children.erase(keys.back()); // 删除最后一个键对应的子节点
-            delete curr; // 释放内存
+    TrieNode::destroy(root, arena);
+    root = TrieNode::create(arena);
+}
+
+size_t Trie::compressLeaves(size_t minKeys) {
+    auto compressRange = [this, minKeys](size_t begin, size_t end) {
+        size_t compressed = 0;
+        for (size_t idx = begin; idx < end; idx++) {
+            TrieArena& subtree = subtreeArena(idx);
+            for (TrieNode* second : root->children[idx]->children) {
+                if (second->keyCount() >= minKeys && second->pack(subtree)) {
+                    compressed++;
+                }
+            }
         }
-        else {
-            printf("Warning: Deleting PSO triple (%s, %s, %s) but node has children, not deleting node.\n",
-                   triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
+        return compressed;
+    };
+    size_t firstCount = root->keys.size();
+    if (!partitioned) {
+        return compressRange(0, firstCount);
+    }
+    // 各分区的 arena 互不相关，分段并行压缩
+    size_t threadCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), firstCount));
+    size_t chunk = (firstCount + threadCount - 1) / std::max<size_t>(1, threadCount);
+    std::vector<std::future<size_t>> futures;
+    for (size_t begin = 0; begin < firstCount; begin += chunk) {
+        futures.push_back(std::async(std::launch::async, compressRange, begin, std::min(firstCount, begin + chunk)));
+    }
+    size_t compressed = 0;
+    for (auto& future : futures) {
+        compressed += future.get();
+    }
+    return compressed;
+}
+
+void Trie::flatten(std::vector<TermId> keys[3], std::vector<uint32_t> starts[2]) const {
+    for (int level = 0; level < 3; level++) {
+        keys[level].clear();
+    }
+    starts[0].assign(1, 0);
+    starts[1].assign(1, 0);
+    keys[0].assign(root->keys.begin(), root->keys.end());
+    for (const TrieNode* first : root->children) {
+        keys[1].insert(keys[1].end(), first->keys.begin(), first->keys.end());
+        starts[0].push_back(static_cast<uint32_t>(keys[1].size()));
+        for (const TrieNode* second : first->children) {
+            second->appendKeys(keys[2]);
+            starts[1].push_back(static_cast<uint32_t>(keys[2].size()));
         }
     }
 }
 
-void Trie::deletePOS(const Triple& triple) {
-    // 删除 POS 顺序的三元组
-    TrieNode* curr = root;
-    TrieNode* parent = nullptr;
-    std::vector<std::string> keys = { triple.predicate, triple.object, triple.subject };
-    for (const auto & key : keys) {
-        if (curr->children.find(key) == curr->children.end()) {
-            return; // 如果找不到对应的路径，直接返回
+void Trie::buildSubtree(TrieNode* first, size_t i, const TermId* const keys[3], const uint32_t* const starts[2],
+                        bool borrowKeys, TrieArena& target) {
+    auto setKeys = [&](TrieNode* node, const TermId* values, size_t n) {
+        if (borrowKeys) {
+            node->keys.borrow(values, n, target);
+        } else {
+            node->keys.assign(values, n, target);
         }
-        parent = curr; // 记录上一个节点
-        curr = curr->children[key];
+    };
+    // 只为前两层创建节点，叶层只有键数组（借用时直接指向外部内存）
+    setKeys(first, keys[1] + starts[0][i], starts[0][i + 1] - starts[0][i]);
+    std::vector<TrieNode*> secondNodes(first->keys.size());
+    for (size_t j = starts[0][i]; j < starts[0][i + 1]; j++) {
+        TrieNode* second = TrieNode::create(target);
+        setKeys(second, keys[2] + starts[1][j], starts[1][j + 1] - starts[1][j]);
+        secondNodes[j - starts[0][i]] = second;
     }
-    if (curr->isEnd) {
-        curr->isEnd = false; // 仅标记为非结束节点，不删除节点
-        // 如果当前节点没有子节点且不是结束节点，删除当前节点
-        if (curr->children.empty()) {
-            parent->children.erase(keys.back()); // 删除最后一个键对应的子节点
-            delete curr; // 释放内存
+    first->children.assign(secondNodes.data(), secondNodes.size(), target);
+}
+
+void Trie::loadLevels(const TermId* const keys[3], const size_t keyCounts[3], const uint32_t* const starts[2],
+                      bool borrowKeys) {
+    clear();
+    if (borrowKeys) {
+        root->keys.borrow(keys[0], keyCounts[0], arena);
+    } else {
+        root->keys.assign(keys[0], keyCounts[0], arena);
+    }
+    std::vector<TrieNode*> firstNodes(keyCounts[0]);
+    if (!partitioned) {
+        for (size_t i = 0; i < keyCounts[0]; i++) {
+            firstNodes[i] = TrieNode::create(arena);
+            buildSubtree(firstNodes[i], i, keys, starts, borrowKeys, arena);
+        }
+    } else {
+        // 每个分区在自己的 arena 中构建，分段并行
+        for (size_t i = 0; i < keyCounts[0]; i++) {
+            partitions.push_back(std::make_unique<Partition>());
+            firstNodes[i] = TrieNode::create(partitions[i]->arena);
+        }
+        size_t threadCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), keyCounts[0]));
+        size_t chunk = (keyCounts[0] + threadCount - 1) / threadCount;
+        std::vector<std::future<void>> futures;
+        for (size_t begin = 0; begin < keyCounts[0]; begin += chunk) {
+            size_t end = std::min(keyCounts[0], begin + chunk);
+            futures.push_back(std::async(std::launch::async, [&, begin, end]() {
+                for (size_t i = begin; i < end; i++) {
+                    buildSubtree(firstNodes[i], i, keys, starts, borrowKeys, partitions[i]->arena);
+                    partitions[i]->recount(firstNodes[i]);
+                }
+            }));
+        }
+        for (auto& future : futures) {
+            future.get();
         }
     }
+    root->children.assign(firstNodes.data(), firstNodes.size(), arena);
+}
+
+// 按 order 指定的顺序将三元组的三个分量依次插入，如 PSO 顺序：先插入 predicate，再 subject，最后 object
+void Trie::insert(const IdTriple& triple) {
+    const int* positions = orderPositions(order);
+    insert(triple.at(positions[0]), triple.at(positions[1]), triple.at(positions[2]));
+}
+
+void Trie::erase(const IdTriple& triple) {
+    const int* positions = orderPositions(order);
+    erase(triple.at(positions[0]), triple.at(positions[1]), triple.at(positions[2]));
 }
 
 
 // 仅用于调试，遍历并打印 Trie 中所有存储的三元组
-void Trie::printAll() {
-    std::vector<std::string> binding;
-    printAllHelper(root, binding);
+void Trie::printAll(const Dictionary& dictionary) {
+    std::vector<TermId> binding;
+    printAllHelper(root, binding, dictionary);
 }
 
-void Trie::printAllHelper(TrieNode* node, std::vector<std::string>& binding) {
-    if (binding.size() == 3 && node->isEnd) {
-        // binding 中顺序为 [predicate, subject, object]，
-        // 但 Triple 构造函数要求 (subject, predicate, object)
-        std::cout << "Triple: (" << binding[1] << ", " << binding[0] << ", " << binding[2] << ")\n";
-    }
-    for (auto& pair : node->children) {
-        binding.push_back(pair.first);
-        printAllHelper(pair.second, binding);
+void Trie::printAllHelper(TrieNode* node, std::vector<TermId>& binding, const Dictionary& dictionary) {
+    std::vector<TermId> keys;
+    node->appendKeys(keys);
+    for (size_t i = 0; i < keys.size(); i++) {
+        binding.push_back(keys[i]);
+        if (binding.size() == 3) {
+            // binding 中为 order 顺序（如 [predicate, subject, object]），
+            // 输出时还原成 (subject, predicate, object)
+            const int* positions = orderPositions(order);
+            TermId terms[3];
+            for (int level = 0; level < 3; level++) {
+                terms[positions[level]] = binding[level];
+            }
+            std::cout << "Triple: (" << dictionary.decode(terms[0]) << ", " << dictionary.decode(terms[1]) << ", "
+                      << dictionary.decode(terms[2]) << ")\n";
+        } else if (i < node->children.size()) {
+            printAllHelper(node->children[i], binding, dictionary);
+        }
         binding.pop_back();
     }
 }
 
 // 在一组 TrieIterator 上执行 leapfrog 交集查找，找到所有迭代器中当前键值相等的位置
 void LeapfrogJoin::leapfrog_search() {
-    if (iterators.empty()) { // 如果没有迭代器，直接返回
+    if (count == 0) { // 如果没有迭代器，直接返回
         done = true;
         return;
     }
     while (true) {
         // 找出所有迭代器中最大的当前key
-        std::string maxKey = iterators[0]->key();
-        for (auto it : iterators) {
+        TermId maxKey = iterators[0]->key();
+        for (size_t i = 1; i < count; i++) {
+            TrieIterator* it = iterators[i];
             if (it->key() > maxKey)
                 maxKey = it->key(); // 遍历更新最大key
         }
         // 对于当前 key 小于 maxKey 的迭代器，执行 seek(maxKey)
         bool allEqual = true;
-        for (TrieIterator* it : iterators) {
+        for (size_t i = 0; i < count; i++) {
+            TrieIterator* it = iterators[i];
             if (it->key() < maxKey) {
                 it->seek(maxKey);
                 if (it->atEnd()) {
@@ -4,9 +4,15 @@
 
 #include <string>
 #include <vector>
-#include <map>
 #include <algorithm>
 #include <iostream>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include "Dictionary.h"
+#include "TrieArena.h"
+#include "PackedKeys.h"
 
 // Triple 和 Rule 类定义
 class Triple {
@@ -35,6 +41,49 @@ public:
     }
 };
 
+// IdTriple：字典编码后的三元组，存储、索引和推理内部都使用它，只在输出时解码回 Triple
+class IdTriple {
+public:
+    TermId subject;
+    TermId predicate;
+    TermId object;
+
+    IdTriple() : subject(Dictionary::NONE), predicate(Dictionary::NONE), object(Dictionary::NONE) {}
+    IdTriple(TermId subject, TermId predicate, TermId object)
+            : subject(subject), predicate(predicate), object(object) {}
+
+    bool operator<(const IdTriple& rhs) const {
+        if (subject != rhs.subject)
+            return subject < rhs.subject;
+        if (predicate != rhs.predicate)
+            return predicate < rhs.predicate;
+        return object < rhs.object;
+    }
+
+    bool operator==(const IdTriple& rhs) const {
+        return subject == rhs.subject && predicate == rhs.predicate && object == rhs.object;
+    }
+
+    bool operator!=(const IdTriple& rhs) const {
+        return !(*this == rhs);
+    }
+
+    // 按位置取分量：0 主语，1 谓语，2 宾语
+    TermId at(int position) const {
+        return position == 0 ? subject : (position == 1 ? predicate : object);
+    }
+};
+
+struct IdTripleHash {
+    size_t operator()(const IdTriple& t) const {
+        uint64_t h = ((static_cast<uint64_t>(t.subject) << 32) | t.object) ^ (t.predicate * 0x9e3779b97f4a7c15ULL);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+};
+
 class Rule {
 public:
     std::string name;
@@ -45,112 +94,311 @@ public:
             : name(std::move(name)), body(body), head(std::move(head)) {}
 };
 
-// TrieNode：Trie 的节点，使用 std::map 保持子节点有序（即 PSO 顺序中的字典顺序）
+// IdRule：编码后的规则，常量为数据项 ID，变量为带 VARIABLE_BIT 标记的变量 ID
+class IdRule {
+public:
+    std::string name;
+    std::vector<IdTriple> body;
+    IdTriple head;
+
+    IdRule(std::string name, std::vector<IdTriple> body, IdTriple head)
+            : name(std::move(name)), body(std::move(body)), head(head) {}
+};
+
+// TrieNode：Trie 的节点，子节点以有序数组的形式连续存储
+// keys 为按 ID 升序排列的子节点键，children[i] 为 keys[i] 对应的子节点
+// 三元组 Trie 的深度固定为 3，最后一层（叶层）只保存 keys，不再为每个键分配节点，children 为空
+// 节点本身和两个数组都从所属 Trie 的 TrieArena 中分配，修改时需要传入该 arena
+// 叶层的键可以压缩为 PackedKeys，修改前会先解压回 keys。叶层没有子节点，压缩后的键放在 children 的位置上，
+// 此时 keys 为空，节点大小不变。联合体中哪个成员有效由 keys 的标记位记录，只在标记时读取 packedLeaf
 class TrieNode {
 public:
-    std::map<std::string, TrieNode*> children;
-    bool isEnd;
+    ArenaArray<TermId> keys;
+    union {
+        ArenaArray<TrieNode*> children;
+        PackedKeys* packedLeaf;
+    };
+
+    TrieNode() : children() {}
+    TrieNode(const TrieNode&) = delete;
+    TrieNode& operator=(const TrieNode&) = delete;
+
+    // 压缩的叶层键，未压缩时返回 nullptr
+    const PackedKeys* packed() const { return keys.tagged() ? packedLeaf : nullptr; }
+    size_t keyCount() const {
+        const PackedKeys* leaf = packed();
+        return leaf != nullptr ? leaf->size() : keys.size();
+    }
+
+    // 在 keys 中二分查找 key 的位置，不存在时返回 keyCount()
+    size_t find(TermId key) const {
+        if (const PackedKeys* leaf = packed()) {
+            return leaf->find(key);
+        }
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        if (it == keys.end() || *it != key) {
+            return keys.size();
+        }
+        return it - keys.begin();
+    }
+
+    // 按顺序把全部键追加到 out
+    void appendKeys(std::vector<TermId>& out) const;
+    // 叶层节点压缩键数组，压缩后更小时才替换，返回是否压缩
+    bool pack(TrieArena& arena);
+    void unpack(TrieArena& arena);
 
-    TrieNode() : isEnd(false) {}
-    ~TrieNode() {
-        for (auto& pair : children) {
-            delete pair.second;
+    TrieNode* findChild(TermId key) const {
+        if (keys.tagged()) {
+            return nullptr; // 压缩的叶层节点没有子节点
         }
+        size_t idx = find(key);
+        return idx < children.size() ? children[idx] : nullptr;
     }
+
+    // 返回 key 对应的子节点，不存在时按序插入新节点
+    TrieNode* getOrCreateChild(TermId key, TrieArena& arena);
+    // 按序插入不存在的 key 及已创建的子节点（子节点可以来自其他 arena），返回插入位置
+    size_t insertChild(TermId key, TrieNode* child, TrieArena& arena);
+    // 删除下标 idx 处的键和子节点指针，不销毁子节点
+    void detachChild(size_t idx, TrieArena& arena);
+    // 叶层插入 key，已存在时返回 false
+    bool insertKey(TermId key, TrieArena& arena);
+    // 删除 key（及其子节点），不存在时返回 false
+    bool eraseKey(TermId key, TrieArena& arena);
+
+    static TrieNode* create(TrieArena& arena);
+    // 将节点及其所有子节点归还到 arena 的空闲链表，供之后的插入复用
+    static void destroy(TrieNode* node, TrieArena& arena);
+};
+
+// 三元组在 Trie 中逐层展开的顺序，共六种排列
+enum class TrieOrder { PSO, POS, SPO, SOP, OSP, OPS };
+
+// 每种顺序下第 0/1/2 层对应的三元组位置（0 主语，1 谓语，2 宾语）
+inline const int* orderPositions(TrieOrder order) {
+    static const int positions[6][3] = {
+            {1, 0, 2}, // PSO
+            {1, 2, 0}, // POS
+            {0, 1, 2}, // SPO
+            {0, 2, 1}, // SOP
+            {2, 0, 1}, // OSP
+            {2, 1, 0}, // OPS
+    };
+    return positions[static_cast<int>(order)];
+}
+
+// 第一层某个键之下第二层各键的扇出（叶层键数）分布，如 PSO 中一个谓语下每个主语的宾语数
+struct FanoutStats {
+    size_t distinct = 0;   // 第二层键数
+    size_t max = 0;
+    double average = 0;
+    std::vector<size_t> histogram; // histogram[k]：扇出在 [2^k, 2^(k+1)) 内的第二层键数
 };
 
 // Trie 类，按 PSO 顺序存储三元组
-// update: 按 PSO 和 POS 两种顺序存储三元组
+// update: 按构造时指定的任一顺序存储三元组，TripleStore 默认维护 PSO 和 POS 两种
+// update: 可按第一层的键分区（PSO/POS 即按谓语纵向分表），每个分区的子树使用独立的 arena 并记录三元组数，
+// 各分区可以并行构建和压缩，分区中最后一个三元组删除时整个 arena 一次释放；根节点仍是普通的 TrieNode，迭代方式不变
 class Trie {
 public:
     TrieNode* root;
+    TrieOrder order;
 
-    Trie() {
-        root = new TrieNode();
-    }
-    ~Trie() {
-        delete root;
+    explicit Trie(TrieOrder order, bool partitioned = false) : order(order), partitioned(partitioned) {
+        root = TrieNode::create(arena);
     }
-
-    void insertPSO(const Triple& triple);
-    void insertPOS(const Triple& triple);
-    void deletePSO(const Triple& triple);
-    void deletePOS(const Triple& triple);
-    void printAll();
+    // 深拷贝：在新的 arena 中复制全部节点
+    Trie(const Trie& other);
+    Trie& operator=(const Trie&) = delete;
+    // 所有节点都在 arena 中，销毁时直接释放 arena 的内存块，不逐个遍历节点
+    ~Trie() = default;
+
+    void insert(const IdTriple& triple);
+    void erase(const IdTriple& triple);
+    // 按 (first, second, third) 路径查找，存在时返回保存 third 的叶层节点，否则返回 nullptr
+    TrieNode* find(TermId first, TermId second, TermId third) const;
+    void printAll(const Dictionary& dictionary);
+    // 删除全部三元组
+    void clear();
+    // 压缩所有不少于 minKeys 个键的叶层节点，返回压缩的节点数；之后被修改的叶层节点会自动解压
+    size_t compressLeaves(size_t minKeys = PackedKeys::BLOCK_SIZE / 8);
+
+    // 按层展开成扁平数组：keys[level] 为该层所有节点的键按先序首尾相接，
+    // starts[level][i] .. starts[level][i + 1] 为第 level 层第 i 个键的子节点键在 keys[level + 1] 中的区间
+    void flatten(std::vector<TermId> keys[3], std::vector<uint32_t> starts[2]) const;
+    // 以 flatten 格式的扁平数组自顶向下一次性重建 Trie，每个节点的键数组只分配一次
+    // borrowKeys 为 true 时各层键数组直接借用而不复制，调用方保证其在 Trie 销毁前有效
+    void loadLevels(const TermId* const keys[3], const size_t keyCounts[3], const uint32_t* const starts[2],
+                    bool borrowKeys);
+
+    // 第一层键为 first 的三元组数
+    size_t countFirst(TermId first) const;
+    // 第一层键为 first 的子树中第二层的扇出分布，不存在时返回 false；分区时为增量维护的精确值，否则遍历子树
+    bool fanoutStats(TermId first, FanoutStats& stats) const;
+    bool isPartitioned() const { return partitioned; }
+    ArenaStats allocationStats() const;
 
 private:
-    void printAllHelper(TrieNode* node, std::vector<std::string>& binding);
+    struct Partition {
+        TrieArena arena;
+        size_t size = 0;
+        std::map<uint32_t, uint32_t> fanouts; // 扇出 → 第二层键数，插入删除时随叶层键数增减
+
+        // 某个第二层键的扇出从 from 变为 to，0 表示不存在
+        void moveFanout(size_t from, size_t to);
+        // 由第一层节点重新统计
+        void recount(const TrieNode* first);
+    };
+
+    TrieArena arena;             // 不分区时存放全部节点，分区时只存放根节点
+    bool partitioned;
+    std::vector<std::unique_ptr<Partition>> partitions; // 与 root 的键一一对应
+
+    TrieArena& subtreeArena(size_t idx) { return partitioned ? partitions[idx]->arena : arena; }
+    // 在根节点插入第一层的键 first，分区时同时创建它的分区，返回插入位置
+    size_t addFirst(TermId first);
+    void removeFirst(size_t idx);
+    // 在 target 中复制 node 及其子树
+    static TrieNode* cloneNode(const TrieNode* node, TrieArena& target);
+    // 以 flatten 格式的第 i 个第一层键构建其子树
+    static void buildSubtree(TrieNode* first, size_t i, const TermId* const keys[3], const uint32_t* const starts[2],
+                             bool borrowKeys, TrieArena& target);
+    void insert(TermId first, TermId second, TermId third);
+    void erase(TermId first, TermId second, TermId third);
+    void printAllHelper(TrieNode* node, std::vector<TermId>& binding, const Dictionary& dictionary);
 
 };
 
-// TrieIterator：对 TrieNode 的子节点进行遍历，提供类似迭代器的接口
+// TrieIterator：对 TrieNode 的有序键数组进行遍历，提供类似迭代器的接口
+// 压缩的叶层节点每次只解码当前所在的一块
 class TrieIterator {
 public:
-    TrieNode* node; // 当前所在节点
-    std::map<std::string, TrieNode*>::iterator it;
-    std::map<std::string, TrieNode*>::iterator end;
-
-    TrieIterator(TrieNode* n) : node(n) {
-        if (node) {
-            it = node->children.begin();
-            end = node->children.end();
-        }
+    const TrieNode* node; // 当前所在节点
+    size_t pos;           // 当前键在 node->keys 中的下标
+    size_t end;
+
+    TrieIterator(const TrieNode* n = nullptr)
+            : node(n), pos(0), end(n ? n->keyCount() : 0), packed(n ? n->packed() : nullptr) {}
+
+    // 就地改为遍历 n，复用已有的迭代器对象
+    void reset(const TrieNode* n) {
+        node = n;
+        pos = 0;
+        end = n ? n->keyCount() : 0;
+        packed = n ? n->packed() : nullptr;
+        decodedBlock = SIZE_MAX;
     }
 
     bool atEnd() const {
-        return it == end;
+        return pos >= end;
     }
 
-    std::string key() const {
+    TermId key() const {
         if(atEnd()) {
-            return ""; // 如果迭代器已到末尾，返回空字符串
+            return Dictionary::NONE; // 如果迭代器已到末尾，返回 NONE（小于所有有效 ID）
         }
-        if(it->first.empty()) {
-            return ""; // 如果当前 key 为空，返回空字符串
+        if (packed != nullptr) {
+            return packedKey();
         }
-        return it->first;
+        return node->keys[pos];
     }
 
     void next() {
         if (!atEnd()) {
-            ++it;
+            ++pos;
         }
     }
 
-    // 跳跃到不小于 target 的位置
-    void seek(const std::string& target) {
-        it = node->children.lower_bound(target);
+    // 跳跃到不小于 target 的位置（只向前移动）
+    // 先以 1, 2, 4, ... 的步长指数探测出目标所在区间，再在区间内二分，代价为 O(log(跳过的键数))
+    void seek(TermId target) {
+        if (atEnd() || key() >= target) {
+            return;
+        }
+        if (packed != nullptr) {
+            seekPacked(target);
+            return;
+        }
+        const TermId* keys = node->keys.data();
+        size_t lo = pos;      // keys[lo] < target
+        size_t step = 1;
+        while (lo + step < end && keys[lo + step] < target) {
+            lo += step;
+            step <<= 1;
+        }
+        size_t hi = std::min(lo + step, end);
+        pos = std::lower_bound(keys + lo + 1, keys + hi, target) - keys;
     }
 
-    // open()：进入当前 key 对应的子节点，返回新的 TrieIterator
+    // open()：进入当前 key 对应的子节点，返回新的 TrieIterator（叶层没有子节点）
     TrieIterator open() {
-        if (!atEnd()) {
-            return TrieIterator(it->second);
+        if (!atEnd() && packed == nullptr && pos < node->children.size()) {
+            return TrieIterator(node->children[pos]);
         }
         return TrieIterator(nullptr);
     }
+
+private:
+    const PackedKeys* packed;
+    mutable TermId block[PackedKeys::BLOCK_SIZE];
+    mutable size_t decodedBlock = SIZE_MAX;
+
+    TermId packedKey() const {
+        size_t current = pos / PackedKeys::BLOCK_SIZE;
+        if (current != decodedBlock) {
+            packed->decodeBlock(current, block);
+            decodedBlock = current;
+        }
+        return block[pos % PackedKeys::BLOCK_SIZE];
+    }
+
+    // 在块首键上指数探测定位目标所在的块，只解码这一块
+    void seekPacked(TermId target) {
+        size_t current = packed->findBlock(target, pos / PackedKeys::BLOCK_SIZE);
+        if (current != decodedBlock) {
+            packed->decodeBlock(current, block);
+            decodedBlock = current;
+        }
+        size_t begin = current == pos / PackedKeys::BLOCK_SIZE ? pos % PackedKeys::BLOCK_SIZE : 0;
+        size_t length = packed->blockLength(current);
+        size_t idx = std::lower_bound(block + begin, block + length, target) - block;
+        // 块内都小于 target 时落在下一块的块首，它一定不小于 target
+        pos = current * PackedKeys::BLOCK_SIZE + idx;
+    }
 };
 
 // LeapfrogJoin类：在一组TrieIterator上实现leapfrog交集查找（适用于单变量join）
+// update: 不再复制迭代器指针数组，直接在调用方提供的数组上排序，构造时不分配内存
 class LeapfrogJoin {
 public:
-    std::vector<TrieIterator*> iterators;
-    int p;       // 当前指针索引
+    TrieIterator** iterators;
+    size_t count;
+    size_t p;    // 当前指针索引
     bool done;   // 标记是否结束
 
-    LeapfrogJoin(std::vector<TrieIterator*>& its) : iterators(its), p(0), done(false) {
+    LeapfrogJoin(TrieIterator** its, size_t n) : iterators(its), count(n), p(0), done(false) {
+        // 任意一个迭代器为空，交集必然为空
+        for (size_t i = 0; i < count; i++) {
+            if (iterators[i]->atEnd()) {
+                done = true;
+                return;
+            }
+        }
         // 对所有迭代器按当前 key 从小到大排序
-        std::sort(iterators.begin(), iterators.end(), [](TrieIterator* a, TrieIterator* b) {
+        std::sort(iterators, iterators + count, [](TrieIterator* a, TrieIterator* b) {
             return a->key() < b->key();
         });
         leapfrog_search();
     }
 
+    LeapfrogJoin(std::vector<TrieIterator*>& its) : LeapfrogJoin(its.data(), its.size()) {}
+
     bool atEnd() const {
         return done;
     }
 
-    std::string key() const {
+    TermId key() const {
         return iterators[p]->key();
     }
 
@@ -164,7 +412,7 @@ public:
             done = true;
             return;
         }
-        p = (p + 1) % iterators.size();
+        p = (p + 1) % count;
         leapfrog_search();
     }
 
@@ -0,0 +1,80 @@
+#include "TrieArena.h"
+
+#include <algorithm>
+#include <new>
+
+TrieArena::~TrieArena() {
+    for (void* block : blocks) {
+        ::operator delete(block);
+    }
+}
+
+size_t TrieArena::sizeClass(size_t bytes) {
+    size_t cls = MIN_CLASS;
+    while ((static_cast<size_t>(1) << cls) < bytes) {
+        cls++;
+    }
+    return cls;
+}
+
+void* TrieArena::newBlock(size_t bytes) {
+    void* block = ::operator new(bytes);
+    blocks.push_back(block);
+    statistics.blocks++;
+    statistics.reservedBytes += bytes;
+    return block;
+}
+
+void* TrieArena::allocate(size_t bytes) {
+    size_t cls = sizeClass(bytes);
+    size_t classBytes = static_cast<size_t>(1) << cls;
+    statistics.allocations++;
+    statistics.liveBytes += classBytes;
+
+    // 优先复用同大小类中已释放的内存
+    if (freeLists[cls] != nullptr) {
+        FreeBlock* block = freeLists[cls];
+        freeLists[cls] = block->next;
+        statistics.reusedAllocations++;
+        return block;
+    }
+
+    if (classBytes > SLAB_SIZE / 2) {
+        return newBlock(classBytes);
+    }
+    if (cursor == nullptr || static_cast<size_t>(limit - cursor) < classBytes) {
+        // 当前 slab 剩余空间不足，按大小类切成空闲块后换一个新的 slab，不浪费尾部空间
+        while (cursor != nullptr && static_cast<size_t>(limit - cursor) >= (static_cast<size_t>(1) << MIN_CLASS)) {
+            size_t tailClass = MIN_CLASS;
+            while ((static_cast<size_t>(2) << tailClass) <= static_cast<size_t>(limit - cursor)) {
+                tailClass++;
+            }
+            auto* tail = reinterpret_cast<FreeBlock*>(cursor);
+            tail->next = freeLists[tailClass];
+            freeLists[tailClass] = tail;
+            cursor += static_cast<size_t>(1) << tailClass;
+        }
+        size_t slabSize = nextSlabSize;
+        while (slabSize < classBytes) {
+            slabSize *= 2;
+        }
+        nextSlabSize = std::min(slabSize * 2, SLAB_SIZE);
+        cursor = static_cast<char*>(newBlock(slabSize));
+        limit = cursor + slabSize;
+    }
+    void* result = cursor;
+    cursor += classBytes;
+    return result;
+}
+
+void TrieArena::deallocate(void* ptr, size_t bytes) {
+    if (ptr == nullptr) {
+        return;
+    }
+    size_t cls = sizeClass(bytes);
+    auto* block = static_cast<FreeBlock*>(ptr);
+    block->next = freeLists[cls];
+    freeLists[cls] = block;
+    statistics.frees++;
+    statistics.liveBytes -= static_cast<size_t>(1) << cls;
+}
@@ -0,0 +1,164 @@
+#ifndef RDFPANDA_STORAGE_TRIEARENA_H
+#define RDFPANDA_STORAGE_TRIEARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// 内存分配统计，用于观察 Trie 的内存使用情况
+struct ArenaStats {
+    size_t blocks = 0;             // 向系统申请的内存块数
+    size_t reservedBytes = 0;      // 向系统申请的总字节数
+    size_t liveBytes = 0;          // 当前在用的字节数（按大小类向上取整）
+    size_t allocations = 0;        // 累计分配次数
+    size_t reusedAllocations = 0;  // 其中直接从空闲链表取得的次数
+    size_t frees = 0;              // 累计释放次数
+
+    ArenaStats& operator+=(const ArenaStats& rhs) {
+        blocks += rhs.blocks;
+        reservedBytes += rhs.reservedBytes;
+        liveBytes += rhs.liveBytes;
+        allocations += rhs.allocations;
+        reusedAllocations += rhs.reusedAllocations;
+        frees += rhs.frees;
+        return *this;
+    }
+};
+
+// TrieArena：Trie 节点和键数组专用的 slab 分配器
+// 请求大小向上取整到 2 的幂（大小类），从 slab 中顺序切分；slab 从 1KB 开始逐个翻倍到 64KB，只存少量数据的 arena
+// （如很少出现的谓语的分区）不会占用整块 64KB。释放的内存挂到对应大小类的空闲链表上，
+// 下次同大小类的分配优先复用。超过半个 64KB slab 的请求单独申请一块。
+// 析构时直接归还所有内存块，不逐个释放节点，因此整棵 Trie 的销毁代价只与内存块数有关
+class TrieArena {
+public:
+    TrieArena() = default;
+    TrieArena(const TrieArena&) = delete;
+    TrieArena& operator=(const TrieArena&) = delete;
+    ~TrieArena();
+
+    void* allocate(size_t bytes);
+    void deallocate(void* ptr, size_t bytes);
+
+    const ArenaStats& stats() const { return statistics; }
+    // 申请 bytes 字节时实际占用的字节数
+    static size_t allocationSize(size_t bytes) { return static_cast<size_t>(1) << sizeClass(bytes); }
+
+private:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t FIRST_SLAB_SIZE = 1024;
+    static constexpr size_t MIN_CLASS = 4;   // 最小 16 字节，足够放下空闲链表指针
+    static constexpr size_t CLASS_COUNT = 48;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    std::vector<void*> blocks;
+    char* cursor = nullptr;   // 当前 slab 中下一个可分配的位置
+    char* limit = nullptr;
+    size_t nextSlabSize = FIRST_SLAB_SIZE;
+    FreeBlock* freeLists[CLASS_COUNT] = {};
+    ArenaStats statistics;
+
+    static size_t sizeClass(size_t bytes);
+    void* newBlock(size_t bytes);
+};
+
+// ArenaArray：从 TrieArena 分配内存的定长元素数组，只用于可平凡复制的元素（TermId、节点指针）
+// 不持有分配器指针，修改时由调用方传入 arena，使 TrieNode 保持紧凑
+// 也可以借用外部只读内存（如快照映射区，此时 capacity 为 0），第一次修改时再复制到 arena 中
+template <typename T>
+class ArenaArray {
+    static_assert(std::is_trivially_copyable<T>::value, "ArenaArray only holds trivially copyable values");
+
+public:
+    ArenaArray() : capacity(0), tag(0) {}
+
+    T* data() { return items; }
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+
+    // 供所有者使用的一个标记位，不占额外空间，分配、释放和借用都不改变它
+    bool tagged() const { return tag != 0; }
+    void setTagged(bool value) { tag = value ? 1 : 0; }
+
+    bool borrowed() const { return capacity == 0 && items != nullptr; }
+    // 在 arena 中占用的字节数（借用时为 0）
+    size_t allocatedBytes() const { return capacity == 0 ? 0 : TrieArena::allocationSize(capacity * sizeof(T)); }
+
+    void insert(size_t pos, const T& value, TrieArena& arena) {
+        if (count >= capacity) {
+            grow(arena);
+        }
+        std::memmove(items + pos + 1, items + pos, (count - pos) * sizeof(T));
+        items[pos] = value;
+        count++;
+    }
+
+    void erase(size_t pos, TrieArena& arena) {
+        if (borrowed()) {
+            grow(arena);
+        }
+        std::memmove(items + pos, items + pos + 1, (count - pos - 1) * sizeof(T));
+        count--;
+    }
+
+    void assign(const T* values, size_t n, TrieArena& arena) {
+        release(arena);
+        if (n == 0) {
+            return;
+        }
+        items = static_cast<T*>(arena.allocate(n * sizeof(T)));
+        capacity = static_cast<uint32_t>(n);
+        count = static_cast<uint32_t>(n);
+        std::memcpy(items, values, n * sizeof(T));
+    }
+
+    // 借用外部内存，调用方保证其在数组释放或被修改前有效
+    void borrow(const T* values, size_t n, TrieArena& arena) {
+        release(arena);
+        items = n == 0 ? nullptr : const_cast<T*>(values);
+        count = static_cast<uint32_t>(n);
+    }
+
+    void release(TrieArena& arena) {
+        if (capacity != 0) {
+            arena.deallocate(items, capacity * sizeof(T));
+        }
+        items = nullptr;
+        count = 0;
+        capacity = 0;
+    }
+
+private:
+    T* items = nullptr;
+    uint32_t count = 0;
+    uint32_t capacity : 31;
+    uint32_t tag : 1;
+
+    void grow(TrieArena& arena) {
+        uint32_t newCapacity = count < 2 ? 4 : count * 2;
+        T* newItems = static_cast<T*>(arena.allocate(newCapacity * sizeof(T)));
+        if (count != 0) {
+            std::memcpy(newItems, items, count * sizeof(T));
+        }
+        if (capacity != 0) {
+            arena.deallocate(items, capacity * sizeof(T));
+        }
+        items = newItems;
+        capacity = newCapacity;
+    }
+};
+
+
+#endif //RDFPANDA_STORAGE_TRIEARENA_H
@@ -0,0 +1,151 @@
+#include "TripleSet.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RDFPANDA_TRIPLESET_SSE2 1
+#endif
+
+uint32_t TripleSet::matchGroup(const int8_t* group, int8_t value) {
+#ifdef RDFPANDA_TRIPLESET_SSE2
+    __m128i ctrlBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrlBytes, _mm_set1_epi8(value))));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP_SIZE; i++) {
+        if (group[i] == value) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static inline int lowestBit(uint32_t mask) {
+    return __builtin_ctz(mask);
+}
+
+size_t TripleSet::findSlot(const IdTriple& triple, size_t hash) const {
+    int8_t h2 = static_cast<int8_t>(hash & 0x7F);
+    size_t group = (hash >> 7) & groupMask;
+    // 三角数步长探测：组数为 2 的幂时可以遍历所有组
+    for (size_t step = 1; ; step++) {
+        const int8_t* groupCtrl = &ctrl[group * GROUP_SIZE];
+        for (uint32_t mask = matchGroup(groupCtrl, h2); mask != 0; mask &= mask - 1) {
+            size_t slot = group * GROUP_SIZE + lowestBit(mask);
+            if (slots[slot] == triple) {
+                return slot;
+            }
+        }
+        // 组内还有空槽，说明插入时不会越过本组，三元组不存在
+        if (matchGroup(groupCtrl, EMPTY) != 0) {
+            return SIZE_MAX;
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+bool TripleSet::contains(const IdTriple& triple) const {
+    return findSlot(triple, IdTripleHash()(triple)) != SIZE_MAX;
+}
+
+bool TripleSet::lookup(const IdTriple& triple, uint32_t& value) const {
+    size_t slot = findSlot(triple, IdTripleHash()(triple));
+    if (slot == SIZE_MAX) {
+        return false;
+    }
+    value = values[slot];
+    return true;
+}
+
+bool TripleSet::update(const IdTriple& triple, uint32_t value) {
+    size_t slot = findSlot(triple, IdTripleHash()(triple));
+    if (slot == SIZE_MAX) {
+        return false;
+    }
+    values[slot] = value;
+    return true;
+}
+
+bool TripleSet::insert(const IdTriple& triple, uint32_t value) {
+    size_t hash = IdTripleHash()(triple);
+    if (findSlot(triple, hash) != SIZE_MAX) {
+        return false;
+    }
+    // 装载率（含墓碑）超过 7/8 时扩容；墓碑较多时原容量重建即可
+    if ((count + tombstones + 1) * 8 > ctrl.size() * 7) {
+        rehash(count * 2 >= ctrl.size() ? ctrl.size() * 2 : ctrl.size());
+    }
+    insertUnique(triple, value, hash);
+    return true;
+}
+
+void TripleSet::insertUnique(const IdTriple& triple, uint32_t value, size_t hash) {
+    int8_t h2 = static_cast<int8_t>(hash & 0x7F);
+    size_t group = (hash >> 7) & groupMask;
+    for (size_t step = 1; ; step++) {
+        int8_t* groupCtrl = &ctrl[group * GROUP_SIZE];
+        uint32_t freeMask = matchGroup(groupCtrl, EMPTY) | matchGroup(groupCtrl, DELETED);
+        if (freeMask != 0) {
+            size_t slot = group * GROUP_SIZE + lowestBit(freeMask);
+            if (ctrl[slot] == DELETED) {
+                tombstones--;
+            }
+            ctrl[slot] = h2;
+            slots[slot] = triple;
+            values[slot] = value;
+            count++;
+            return;
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+bool TripleSet::erase(const IdTriple& triple) {
+    uint32_t value;
+    return erase(triple, value);
+}
+
+bool TripleSet::erase(const IdTriple& triple, uint32_t& value) {
+    size_t slot = findSlot(triple, IdTripleHash()(triple));
+    if (slot == SIZE_MAX) {
+        return false;
+    }
+    value = values[slot];
+    ctrl[slot] = DELETED;
+    count--;
+    tombstones++;
+    return true;
+}
+
+void TripleSet::clear() {
+    std::fill(ctrl.begin(), ctrl.end(), EMPTY);
+    count = 0;
+    tombstones = 0;
+}
+
+void TripleSet::reserve(size_t n) {
+    size_t capacity = ctrl.size();
+    while ((n + tombstones) * 8 > capacity * 7) {
+        capacity *= 2;
+    }
+    if (capacity != ctrl.size()) {
+        rehash(capacity);
+    }
+}
+
+void TripleSet::rehash(size_t newCapacity) {
+    std::vector<int8_t> oldCtrl(newCapacity, EMPTY);
+    std::vector<IdTriple> oldSlots(newCapacity);
+    std::vector<uint32_t> oldValues(newCapacity);
+    oldCtrl.swap(ctrl);
+    oldSlots.swap(slots);
+    oldValues.swap(values);
+    groupMask = newCapacity / GROUP_SIZE - 1;
+    count = 0;
+    tombstones = 0;
+    for (size_t i = 0; i < oldCtrl.size(); i++) {
+        if (oldCtrl[i] >= 0) {
+            insertUnique(oldSlots[i], oldValues[i], IdTripleHash()(oldSlots[i]));
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef RDFPANDA_STORAGE_TRIPLESET_H
+#define RDFPANDA_STORAGE_TRIPLESET_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Trie.h"
+
+// TripleSet：编码三元组的开放寻址哈希集合，用于 O(1) 判断三元组是否在事实库中
+// 每个三元组可附带一个 32 位值，TripleStore 用它记录三元组在主存储 vector 中的下标
+// 布局参考 SwissTable：每个槽位对应一个控制字节，空槽为 EMPTY，删除后为 DELETED，
+// 占用时保存哈希值的低 7 位；探测以 16 个槽位为一组，用 SSE2 一次比较整组控制字节，
+// 只有控制字节匹配的槽位才需要比较三元组本身
+class TripleSet {
+public:
+    TripleSet() { rehash(MIN_CAPACITY); }
+
+    // 插入三元组，原本不存在时返回 true；已存在时不修改附带值
+    bool insert(const IdTriple& triple, uint32_t value = 0);
+    // 删除三元组，原本存在时返回 true，并可取出附带值
+    bool erase(const IdTriple& triple);
+    bool erase(const IdTriple& triple, uint32_t& value);
+    bool contains(const IdTriple& triple) const;
+    // 查询附带值，不存在时返回 false
+    bool lookup(const IdTriple& triple, uint32_t& value) const;
+    // 修改已存在三元组的附带值，不存在时返回 false
+    bool update(const IdTriple& triple, uint32_t value);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear();
+    // 预留至少能容纳 n 个三元组的空间，避免批量插入时多次扩容
+    void reserve(size_t n);
+
+private:
+    static constexpr size_t GROUP_SIZE = 16;
+    static constexpr size_t MIN_CAPACITY = GROUP_SIZE;
+    static constexpr int8_t EMPTY = -128;   // 0b10000000
+    static constexpr int8_t DELETED = -2;   // 0b11111110
+
+    std::vector<int8_t> ctrl;    // 控制字节，长度等于容量
+    std::vector<IdTriple> slots;
+    std::vector<uint32_t> values;
+    size_t count = 0;
+    size_t tombstones = 0;
+    size_t groupMask = 0;        // 组数 - 1，组数为 2 的幂
+
+    // 返回 triple 所在槽位，不存在时返回 SIZE_MAX
+    size_t findSlot(const IdTriple& triple, size_t hash) const;
+    // 插入已确认不存在的三元组，调用方保证有空闲槽位
+    void insertUnique(const IdTriple& triple, uint32_t value, size_t hash);
+    void rehash(size_t newCapacity);
+    // 在整组控制字节中找出等于 value 的槽位，返回位掩码（第 i 位对应组内第 i 个槽位）
+    static uint32_t matchGroup(const int8_t* group, int8_t value);
+};
+
+
+#endif //RDFPANDA_STORAGE_TRIPLESET_H
@@ -1,10 +1,111 @@
 #include "TripleStore.h"
 
-void TripleStore::addTriple(const Triple& triple) {
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <string_view>
+#include <thread>
+
+namespace {
+constexpr int RADIX_BITS = 11;
+constexpr size_t BULK_CHUNK_MIN = 1 << 14; // 每个编码线程至少处理的三元组数
+
+// LSD 基数排序：按 order 的最后一层到第一层依次对分量做稳定的按位计数排序，高位全为 0 的轮次跳过
+void radixSort(std::vector<IdTriple>& triples, TrieOrder order) {
+    const int* positions = orderPositions(order);
+    std::vector<IdTriple> buffer(triples.size());
+    std::vector<size_t> counts(static_cast<size_t>(1) << RADIX_BITS);
+    const TermId mask = (1u << RADIX_BITS) - 1;
+    for (int level = 2; level >= 0; level--) {
+        int position = positions[level];
+        TermId maxKey = 0;
+        for (const auto& triple : triples) {
+            maxKey = std::max(maxKey, triple.at(position));
+        }
+        for (int shift = 0; shift < 32 && (maxKey >> shift) != 0; shift += RADIX_BITS) {
+            std::fill(counts.begin(), counts.end(), 0);
+            for (const auto& triple : triples) {
+                counts[(triple.at(position) >> shift) & mask]++;
+            }
+            size_t sum = 0;
+            for (auto& count : counts) {
+                size_t current = count;
+                count = sum;
+                sum += current;
+            }
+            for (const auto& triple : triples) {
+                buffer[counts[(triple.at(position) >> shift) & mask]++] = triple;
+            }
+            triples.swap(buffer);
+        }
+    }
+}
+
+// 已按 order 排序的三元组转换为 Trie::flatten 格式的扁平层数组，相邻的重复三元组在这一遍中丢弃
+void buildLevels(const std::vector<IdTriple>& sorted, TrieOrder order,
+                 std::vector<TermId> keys[3], std::vector<uint32_t> starts[2]) {
+    const int* positions = orderPositions(order);
+    for (int level = 0; level < 3; level++) {
+        keys[level].clear();
+    }
+    keys[2].reserve(sorted.size());
+    starts[0].assign(1, 0);
+    starts[1].assign(1, 0);
+    for (const auto& triple : sorted) {
+        TermId first = triple.at(positions[0]);
+        TermId second = triple.at(positions[1]);
+        TermId third = triple.at(positions[2]);
+        bool newFirst = keys[0].empty() || keys[0].back() != first;
+        bool newSecond = newFirst || keys[1].back() != second;
+        if (!newSecond && keys[2].back() == third) {
+            continue;
+        }
+        if (newFirst) {
+            if (!keys[0].empty()) {
+                starts[0].push_back(static_cast<uint32_t>(keys[1].size()));
+            }
+            keys[0].push_back(first);
+        }
+        if (newSecond) {
+            if (!keys[1].empty()) {
+                starts[1].push_back(static_cast<uint32_t>(keys[2].size()));
+            }
+            keys[1].push_back(second);
+        }
+        keys[2].push_back(third);
+    }
+    if (!keys[0].empty()) {
+        starts[0].push_back(static_cast<uint32_t>(keys[1].size()));
+        starts[1].push_back(static_cast<uint32_t>(keys[2].size()));
+    }
+}
+}
+
+IdTriple TripleStore::encode(const Triple& triple) {
+    return IdTriple(dictionary->encode(triple.subject),
+                    dictionary->encode(triple.predicate),
+                    dictionary->encode(triple.object));
+}
+
+Triple TripleStore::decode(const IdTriple& triple) const {
+    return Triple(std::string(dictionary->decode(triple.subject)),
+                  std::string(dictionary->decode(triple.predicate)),
+                  std::string(dictionary->decode(triple.object)));
+}
+
+bool TripleStore::addTriple(const Triple& triple) {
+    return addTriple(encode(triple));
+}
+
+bool TripleStore::addTriple(const IdTriple& triple) {
     //  printf("Adding triple: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
-    // 添加到vector
+    materialize();
+    // 先插入哈希集合（记录即将使用的下标，删除时据此 O(1) 定位），已存在则直接返回，保证主存储和索引中没有重复
+    size_t index = triples.size();
+    if (!tripleSet.insert(triple, static_cast<uint32_t>(index))) {
+        return false;
+    }
     triples.push_back(triple);
-    size_t index = triples.size() - 1;
 
     // 更新索引
     subject_index[triple.subject].push_back(index);
@@ -12,105 +113,871 @@ void TripleStore::addTriple(const Triple& triple) {
     object_index[triple.object].push_back(index);
 
     // update: 使用Trie树优化
-    triePSO.insertPSO(triple);
-    triePOS.insertPOS(triple);
+    triePSO.insert(triple);
+    triePOS.insert(triple);
+    if (allOrders) {
+        trieSPO.insert(triple);
+        trieSOP.insert(triple);
+        trieOSP.insert(triple);
+        trieOPS.insert(triple);
+    }
+    return true;
 }
 
 void TripleStore::deleteTriple(const Triple& triple) {
-    // 从vector中删除三元组
+    // 词典中不存在的项不可能出现在存储中
+    IdTriple encoded(dictionary->lookup(triple.subject),
+                     dictionary->lookup(triple.predicate),
+                     dictionary->lookup(triple.object));
+    if (encoded.subject == Dictionary::NONE || encoded.predicate == Dictionary::NONE || encoded.object == Dictionary::NONE) {
+        return;
+    }
+    deleteTriple(encoded);
+}
+
+void TripleStore::deleteTriple(const IdTriple& triple) {
+    materialize();
+    // 通过哈希集合 O(1) 找到三元组在vector中的下标
     // printf("Deleting triple: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
-    auto it = std::find(triples.begin(), triples.end(), triple);
+    uint32_t index;
+    if (!tripleSet.erase(triple, index)) {
+        return;
+    }
+
+    // 不移动vector中的元素，只把该位置标记为墓碑；各索引中指向它的下标在查询时跳过，压缩时统一清理
+    retire(triple, index);
+    triples[index] = IdTriple();
+    tombstoneCount++;
+
+    // update: 使用Trie树优化
+    triePSO.erase(triple);
+    triePOS.erase(triple);
+    if (allOrders) {
+        trieSPO.erase(triple);
+        trieSOP.erase(triple);
+        trieOSP.erase(triple);
+        trieOPS.erase(triple);
+    }
+
+    if (tombstoneCount >= COMPACTION_MIN_TOMBSTONES &&
+        tombstoneCount > triples.size() * COMPACTION_TOMBSTONE_RATIO) {
+        compact();
+    }
+}
+
+void TripleStore::compact() {
+    materialize();
+    // 重写vector，去掉墓碑，同时更新哈希集合中记录的下标并重建多级索引
+    std::vector<IdTriple> live;
+    live.reserve(triples.size() - tombstoneCount);
+    subject_index.clear();
+    predicate_index.clear();
+    object_index.clear();
+    // 压缩保持相对顺序，固定的版本和上次发布时的前缀长度改为其中存活的三元组数
+    auto pinned = pinnedVersions.begin();
+    size_t published = triples.size();
+    for (size_t index = 0; index < triples.size(); index++) {
+        for (; pinned != pinnedVersions.end() && pinned->second.prefix <= index; ++pinned) {
+            pinned->second.prefix = live.size();
+        }
+        if (publishedPrefix == index) {
+            published = live.size();
+        }
+        const IdTriple& triple = triples[index];
+        if (isTombstone(triple)) {
+            continue;
+        }
+        size_t newIndex = live.size();
+        live.push_back(triple);
+        tripleSet.update(triple, static_cast<uint32_t>(newIndex));
+        subject_index[triple.subject].push_back(newIndex);
+        predicate_index[triple.predicate].push_back(newIndex);
+        object_index[triple.object].push_back(newIndex);
+    }
+    for (; pinned != pinnedVersions.end(); ++pinned) {
+        pinned->second.prefix = live.size();
+    }
+    publishedPrefix = publishedPrefix >= triples.size() ? live.size() : published;
+    triples.swap(live);
+    tombstoneCount = 0;
+}
+
+StoreVersion TripleStore::pinVersion() const {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    // 批次进行中时只能看到上一批次发布后的内容
+    // 尚未建主存储时，建成后的前 lazyCount 个三元组就是当前内容
+    currentVersion++;
+    size_t prefix = batchDepth != 0 ? publishedPrefix : lazyTriples ? lazyCount : triples.size();
+    pinnedVersions[currentVersion] = PinnedVersion{prefix, 0};
+    return StoreVersion(this, currentVersion, lock);
+}
+
+void TripleStore::pin(uint32_t version) const {
+    pinnedVersions[version].refs++;
+}
+
+void TripleStore::unpin(uint32_t version) const {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = pinnedVersions.find(version);
+    if (--it->second.refs != 0) {
+        return;
+    }
+    auto next = pinnedVersions.erase(it);
+    // 释放 version 前可见、释放后不可见的区间一定包含 version，且不包含下一个固定的版本，
+    // 即结束版本在 [version, 下一个固定版本) 内；释放最早的版本时就是结束在新的最早版本之前的区间
+    pruneRetired(version, next == pinnedVersions.end() ? OPEN_VERSION : next->first);
+}
+
+bool TripleStore::retiredVisible(uint32_t first, uint32_t last) const {
+    auto pinned = pinnedVersions.lower_bound(first);
+    return pinned != pinnedVersions.end() && pinned->first <= last;
+}
 
-    if (it != triples.end()) {
-        size_t index = std::distance(triples.begin(), it);
-        // triples.erase(it);
-        // printf("Triple found at index: %zu\n", index);
-        // 更新索引
-        auto& subject_indices = subject_index[triple.subject];
-        subject_indices.erase(std::remove(subject_indices.begin(), subject_indices.end(), index), subject_indices.end());
-        if (subject_indices.empty()) {
-            subject_index.erase(triple.subject);
+void TripleStore::pruneRetired(uint32_t from, uint32_t to) const {
+    for (auto entry = retiredByEnd.lower_bound(from); entry != retiredByEnd.end() && entry->first < to;) {
+        if (retiredVisible(entry->second.first, entry->first)) {
+            ++entry;
+            continue;
         }
+        dropRetired(entry->second.second, {entry->second.first, entry->first});
+        entry = retiredByEnd.erase(entry);
+    }
+}
+
+void TripleStore::dropRetired(const IdTriple& triple, const std::pair<uint32_t, uint32_t>& interval) const {
+    auto entry = retired.find(triple);
+    auto& intervals = entry->second;
+    intervals.erase(std::find(intervals.begin(), intervals.end(), interval));
+    if (intervals.empty()) {
+        unindexRetired(triple);
+        retired.erase(entry);
+    }
+}
+
+void TripleStore::unindexRetired(const IdTriple& triple) const {
+    auto unindex = [&triple](std::unordered_map<TermId, std::vector<IdTriple>>& groups, TermId key) {
+        auto it = groups.find(key);
+        auto& group = it->second;
+        *std::find(group.begin(), group.end(), triple) = group.back();
+        group.pop_back();
+        if (group.empty()) {
+            groups.erase(it);
+        }
+    };
+    unindex(retiredBySubject, triple.subject);
+    unindex(retiredByPredicate, triple.predicate);
+    unindex(retiredByObject, triple.object);
+}
+
+void TripleStore::retire(const IdTriple& triple, size_t index) {
+    // 前缀长度随版本号单调不减，第一个前缀包含 index 的版本及之后的版本都能看到它，之后固定的版本看不到；
+    // 批次进行中固定的版本看到的是上次发布时的内容，所以在发布之前区间保持开放
+    uint32_t first = OPEN_VERSION;
+    for (const auto& pinned : pinnedVersions) {
+        if (pinned.second.prefix > index) {
+            first = pinned.first;
+            break;
+        }
+    }
+    if (first == OPEN_VERSION && batchDepth != 0 && index < publishedPrefix) {
+        first = currentVersion + 1;
+    }
+    if (first == OPEN_VERSION) {
+        return;
+    }
+    auto& intervals = retired[triple];
+    if (intervals.empty()) {
+        retiredBySubject[triple.subject].push_back(triple);
+        retiredByPredicate[triple.predicate].push_back(triple);
+        retiredByObject[triple.object].push_back(triple);
+    }
+    intervals.emplace_back(first, batchDepth != 0 ? OPEN_VERSION : currentVersion);
+    if (batchDepth != 0) {
+        batchRetired.push_back(triple);
+    } else {
+        retiredByEnd.emplace(currentVersion, std::make_pair(first, triple));
+    }
+}
 
-        auto& predicate_indices = predicate_index[triple.predicate];
-        
-        predicate_indices.erase(std::remove(predicate_indices.begin(), predicate_indices.end(), index), predicate_indices.end());
-        if (predicate_indices.empty()) {
-            predicate_index.erase(triple.predicate);
+void TripleStore::beginBatch() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    materialize();
+    if (batchDepth++ == 0) {
+        publishedPrefix = triples.size();
+    }
+}
+
+void TripleStore::publishBatch() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (--batchDepth != 0) {
+        return;
+    }
+    // 结束本批次的区间：批次中没有固定过版本时区间为空（起始版本大于结束版本），直接回收，
+    // 其余的按结束版本记入 retiredByEnd；之前结束的区间不受发布影响，不再检查
+    for (const auto& triple : batchRetired) {
+        auto entry = retired.find(triple);
+        if (entry == retired.end()) {
+            continue;
         }
+        std::vector<std::pair<uint32_t, uint32_t>> unseen;
+        for (auto& interval : entry->second) {
+            if (interval.second != OPEN_VERSION) {
+                continue;
+            }
+            interval.second = currentVersion;
+            if (retiredVisible(interval.first, interval.second)) {
+                retiredByEnd.emplace(currentVersion, std::make_pair(interval.first, triple));
+            } else {
+                unseen.push_back(interval);
+            }
+        }
+        for (const auto& interval : unseen) {
+            dropRetired(triple, interval);
+        }
+    }
+    batchRetired.clear();
+}
 
-        auto& object_indices = object_index[triple.object];
-        object_indices.erase(std::remove(object_indices.begin(), object_indices.end(), index), object_indices.end());
-        if (object_indices.empty()) {
-            object_index.erase(triple.object);
+bool TripleStore::retiredAt(const std::vector<std::pair<uint32_t, uint32_t>>& intervals, uint32_t version) {
+    for (const auto& interval : intervals) {
+        if (interval.first <= version && version <= interval.second) {
+            return true;
         }
+    }
+    return false;
+}
+
+bool TripleStore::containsAt(const IdTriple& triple, uint32_t version) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    // 尚未建主存储时存储没有被修改过，各版本看到的都是快照的内容
+    if (lazyTriples) {
+        return contains(triple);
+    }
+    uint32_t index;
+    if (tripleSet.lookup(triple, index) && index < pinnedVersions.at(version).prefix) {
+        return true;
+    }
+    auto it = retired.find(triple);
+    return it != retired.end() && retiredAt(it->second, version);
+}
+
+std::vector<IdTriple> TripleStore::matchAt(const IdTriple& pattern, uint32_t version) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    size_t prefix = pinnedVersions.at(version).prefix;
+    auto matches = [&pattern](const IdTriple& triple) {
+        return (pattern.subject == Dictionary::NONE || pattern.subject == triple.subject) &&
+               (pattern.predicate == Dictionary::NONE || pattern.predicate == triple.predicate) &&
+               (pattern.object == Dictionary::NONE || pattern.object == triple.object);
+    };
+    std::vector<IdTriple> result;
+    if (lazyTriples) {
+        forEachSnapshotTriple(pattern.predicate, [&](const IdTriple& triple) {
+            if (matches(triple)) {
+                result.push_back(triple);
+            }
+        });
+        return result;
+    }
+    // 有常量时只扫描对应的多级索引，主语、宾语通常比谓语更有选择性
+    const std::vector<size_t>* postings = nullptr;
+    const std::unordered_map<TermId, std::vector<size_t>>* index = nullptr;
+    const std::unordered_map<TermId, std::vector<IdTriple>>* retiredIndex = nullptr;
+    TermId key = Dictionary::NONE;
+    if (pattern.subject != Dictionary::NONE) {
+        index = &subject_index;
+        retiredIndex = &retiredBySubject;
+        key = pattern.subject;
+    } else if (pattern.object != Dictionary::NONE) {
+        index = &object_index;
+        retiredIndex = &retiredByObject;
+        key = pattern.object;
+    } else if (pattern.predicate != Dictionary::NONE) {
+        index = &predicate_index;
+        retiredIndex = &retiredByPredicate;
+        key = pattern.predicate;
+    }
+    if (index != nullptr) {
+        auto it = index->find(key);
+        if (it != index->end()) {
+            postings = &it->second;
+        }
+        if (postings != nullptr) {
+            for (size_t position : *postings) {
+                if (position < prefix && !isTombstone(triples[position]) && matches(triples[position])) {
+                    result.push_back(triples[position]);
+                }
+            }
+        }
+    } else {
+        for (size_t position = 0; position < prefix; position++) {
+            if (!isTombstone(triples[position])) {
+                result.push_back(triples[position]);
+            }
+        }
+    }
+    // 历史同样只看与常量对应的分组，不随 retired 的总量增长
+    if (retiredIndex != nullptr) {
+        auto it = retiredIndex->find(key);
+        if (it != retiredIndex->end()) {
+            for (const auto& triple : it->second) {
+                if (matches(triple) && retiredAt(retired.at(triple), version)) {
+                    result.push_back(triple);
+                }
+            }
+        }
+    } else {
+        for (const auto& entry : retired) {
+            if (retiredAt(entry.second, version)) {
+                result.push_back(entry.first);
+            }
+        }
+    }
+    return result;
+}
+
+StoreVersion::StoreVersion(const TripleStore* store, uint32_t version, const std::unique_lock<std::shared_mutex>&)
+        : store(store), version(version) {
+    store->pin(version);
+}
+
+StoreVersion::StoreVersion(const StoreVersion& other) : store(other.store), version(other.version) {
+    if (store != nullptr) {
+        std::unique_lock<std::shared_mutex> lock(store->mutex);
+        store->pin(version);
+    }
+}
+
+StoreVersion& StoreVersion::operator=(const StoreVersion& other) {
+    if (this == &other) {
+        return *this;
+    }
+    if (store != nullptr) {
+        store->unpin(version);
+    }
+    store = other.store;
+    version = other.version;
+    if (store != nullptr) {
+        std::unique_lock<std::shared_mutex> lock(store->mutex);
+        store->pin(version);
+    }
+    return *this;
+}
 
-        // update: 使用Trie树优化
-        triePSO.deletePSO(triple);
-        triePOS.deletePOS(triple);
-        // printf("\nDeleted triple: (%s, %s, %s)\n", triple.subject.c_str(), triple.predicate.c_str(), triple.object.c_str());
-        // printf("Remaining triples: %zu\n", triples.size());
-        // triePSO.printAll(); // 调试用，打印所有三元组
-        // triePOS.printAll(); // 调试用，打印所有三元组
+StoreVersion::~StoreVersion() {
+    if (store != nullptr) {
+        store->unpin(version);
     }
 }
 
+bool StoreVersion::contains(const IdTriple& triple) const {
+    return store != nullptr && store->containsAt(triple, version);
+}
+
+std::vector<IdTriple> StoreVersion::match(const IdTriple& pattern) const {
+    return store != nullptr ? store->matchAt(pattern, version) : std::vector<IdTriple>();
+}
+
+std::vector<IdTriple> StoreVersion::getAllIdTriples() const {
+    return match(IdTriple());
+}
+
 std::vector<Triple> TripleStore::queryBySubject(const std::string& subject) {
     // 返回主语为subject的所有三元组
-    if (subject_index.find(subject) == subject_index.end()) {
+    materialize();
+    auto it = subject_index.find(dictionary->lookup(subject));
+    if (it == subject_index.end()) {
         return {};
     }
     std::vector<Triple> result;
-    for (size_t index : subject_index[subject]) {
-        result.push_back(triples[index]);
+    for (size_t index : it->second) {
+        if (!isTombstone(triples[index])) {
+            result.push_back(decode(triples[index]));
+        }
     }
     return result;
 }
 
 std::vector<Triple> TripleStore::queryByPredicate(const std::string& predicate) {
     // 返回谓语为predicate的所有三元组
-    if (predicate_index.find(predicate) == predicate_index.end()) {
+    materialize();
+    auto it = predicate_index.find(dictionary->lookup(predicate));
+    if (it == predicate_index.end()) {
         return {};
     }
     std::vector<Triple> result;
-    for (size_t index : predicate_index[predicate]) {
+    for (size_t index : it->second) {
         // printf("Found triple with predicate: %s at index: %zu\n", predicate.c_str(), index);
-        result.push_back(triples[index]);
+        if (!isTombstone(triples[index])) {
+            result.push_back(decode(triples[index]));
+        }
     }
     return result;
 }
 
 std::vector<Triple> TripleStore::queryByObject(const std::string& object) {
     // 返回宾语为object的所有三元组
-    if (object_index.find(object) == object_index.end()) {
+    materialize();
+    auto it = object_index.find(dictionary->lookup(object));
+    if (it == object_index.end()) {
         return {};
     }
     std::vector<Triple> result;
-    for (size_t index : object_index[object]) {
-        result.push_back(triples[index]);
+    for (size_t index : it->second) {
+        if (!isTombstone(triples[index])) {
+            result.push_back(decode(triples[index]));
+        }
     }
     return result;
 }
 
 std::vector<Triple> TripleStore::getAllTriples() const {
     std::vector<Triple> allTriples;
-    for(const auto& predicate : predicate_index) {
-        for (size_t index : predicate.second) {
-            allTriples.push_back(triples[index]);
+    for (const auto& triple : getAllIdTriples()) {
+        allTriples.push_back(decode(triple));
+    }
+    return allTriples;
+}
+
+std::vector<IdTriple> TripleStore::getAllIdTriples() const {
+    std::vector<IdTriple> allTriples;
+    if (lazyTriples) {
+        allTriples.reserve(lazyCount);
+        forEachSnapshotTriple(Dictionary::NONE, [&allTriples](const IdTriple& triple) {
+            allTriples.push_back(triple);
+        });
+        return allTriples;
+    }
+    allTriples.reserve(triples.size() - tombstoneCount);
+    for (const auto& triple : triples) {
+        if (!isTombstone(triple)) {
+            allTriples.push_back(triple);
         }
     }
     return allTriples;
 }
 
-TrieNode* TripleStore::getNodeByTriple(const Triple& triple) const {
-    // 返回指定三元组的Trie节点
-    TrieNode* node = triePSO.root;
-    std::vector<std::string> keys = { triple.predicate, triple.subject, triple.object };
-    for (const auto & key : keys) {
-        if (node->children.find(key) == node->children.end()) {
-            return nullptr;
+TrieNode* TripleStore::getTrieRoot(TrieOrder order) const {
+    switch (order) {
+        case TrieOrder::PSO: return triePSO.root;
+        case TrieOrder::POS: return triePOS.root;
+        case TrieOrder::SPO: return allOrders ? trieSPO.root : nullptr;
+        case TrieOrder::SOP: return allOrders ? trieSOP.root : nullptr;
+        case TrieOrder::OSP: return allOrders ? trieOSP.root : nullptr;
+        case TrieOrder::OPS: return allOrders ? trieOPS.root : nullptr;
+    }
+    return nullptr;
+}
+
+bool TripleStore::getPredicateTable(TermId predicate, PredicateTable& table) const {
+    const TrieNode* bySubject = triePSO.root->findChild(predicate);
+    if (bySubject == nullptr) {
+        return false;
+    }
+    const TrieNode* byObject = triePOS.root->findChild(predicate);
+    table.predicate = predicate;
+    table.bySubject = bySubject;
+    table.byObject = byObject;
+    table.size = triePSO.countFirst(predicate);
+    table.distinctSubjects = bySubject->keyCount();
+    table.distinctObjects = byObject->keyCount();
+    return true;
+}
+
+std::vector<TermId> TripleStore::getPredicates() const {
+    return std::vector<TermId>(triePSO.root->keys.begin(), triePSO.root->keys.end());
+}
+
+bool TripleStore::getPredicateStats(TermId predicate, PredicateStats& stats) const {
+    if (!triePSO.fanoutStats(predicate, stats.perSubject)) {
+        return false;
+    }
+    triePOS.fanoutStats(predicate, stats.perObject);
+    stats.predicate = predicate;
+    stats.size = triePSO.countFirst(predicate);
+    return true;
+}
+
+ArenaStats TripleStore::getAllocationStats() const {
+    ArenaStats stats = triePSO.allocationStats();
+    stats += triePOS.allocationStats();
+    if (allOrders) {
+        stats += trieSPO.allocationStats();
+        stats += trieSOP.allocationStats();
+        stats += trieOSP.allocationStats();
+        stats += trieOPS.allocationStats();
+    }
+    return stats;
+}
+
+size_t TripleStore::compressLeaves() {
+    size_t compressed = triePSO.compressLeaves() + triePOS.compressLeaves();
+    if (allOrders) {
+        compressed += trieSPO.compressLeaves() + trieSOP.compressLeaves() +
+                      trieOSP.compressLeaves() + trieOPS.compressLeaves();
+    }
+    return compressed;
+}
+
+void TripleStore::enableAllOrders() {
+    if (allOrders) {
+        return;
+    }
+    allOrders = true;
+    for (const auto& triple : getAllIdTriples()) {
+        trieSPO.insert(triple);
+        trieSOP.insert(triple);
+        trieOSP.insert(triple);
+        trieOPS.insert(triple);
+    }
+}
+
+void TripleStore::clear() {
+    triples.clear();
+    tombstoneCount = 0;
+    lazyTriples = false;
+    lazyCount = 0;
+    tripleSet.clear();
+    subject_index.clear();
+    predicate_index.clear();
+    object_index.clear();
+    triePSO.clear();
+    triePOS.clear();
+    trieSPO.clear();
+    trieSOP.clear();
+    trieOSP.clear();
+    trieOPS.clear();
+}
+
+bool TripleStore::saveSnapshot(const std::string& path, const std::vector<IdTriple>* explicitFacts) const {
+    SnapshotWriter writer(path);
+    if (!writer.good()) {
+        return false;
+    }
+
+    std::string strings;
+    std::vector<uint64_t> offsets;
+    std::vector<TermId> table;
+    dictionary->exportTerms(strings, offsets, table);
+    writer.addSection(strings.data(), strings.size());
+    writer.addSection(offsets.data(), offsets.size() * sizeof(uint64_t));
+    writer.addSection(table.data(), table.size() * sizeof(TermId));
+
+    // PSO、POS 各五段，顺序与 SnapshotSection 一致
+    for (const Trie* trie : {&triePSO, &triePOS}) {
+        std::vector<TermId> keys[3];
+        std::vector<uint32_t> starts[2];
+        trie->flatten(keys, starts);
+        writer.addSection(keys[0].data(), keys[0].size() * sizeof(TermId));
+        writer.addSection(starts[0].data(), starts[0].size() * sizeof(uint32_t));
+        writer.addSection(keys[1].data(), keys[1].size() * sizeof(TermId));
+        writer.addSection(starts[1].data(), starts[1].size() * sizeof(uint32_t));
+        writer.addSection(keys[2].data(), keys[2].size() * sizeof(TermId));
+    }
+
+    static_assert(sizeof(IdTriple) == 3 * sizeof(TermId), "IdTriple is written to snapshots as three TermIds");
+    if (explicitFacts != nullptr) {
+        writer.addSection(explicitFacts->data(), explicitFacts->size() * sizeof(IdTriple));
+    } else {
+        writer.addSection(nullptr, 0);
+    }
+    return writer.finish(explicitFacts != nullptr ? SNAPSHOT_HAS_EXPLICIT_FACTS : 0);
+}
+
+void TripleStore::snapshotLevels(const MappedSnapshot& mapped, SnapshotSection firstSection,
+                                 const TermId* keys[3], size_t keyCounts[3], const uint32_t* starts[2]) {
+    size_t startCount;
+    keys[0] = mapped.section<TermId>(firstSection, keyCounts[0]);
+    starts[0] = mapped.section<uint32_t>(static_cast<SnapshotSection>(firstSection + 1), startCount);
+    keys[1] = mapped.section<TermId>(static_cast<SnapshotSection>(firstSection + 2), keyCounts[1]);
+    starts[1] = mapped.section<uint32_t>(static_cast<SnapshotSection>(firstSection + 3), startCount);
+    keys[2] = mapped.section<TermId>(static_cast<SnapshotSection>(firstSection + 4), keyCounts[2]);
+}
+
+bool TripleStore::validSnapshot(const MappedSnapshot& mapped) {
+    // 词典：offsets 至少有一项（截断的文件或缺少该段时 offsetCount - 1 会回绕），首尾与字符串段一致；哈希表大小为 2 的幂
+    size_t stringCount, offsetCount, tableSize;
+    mapped.section<char>(DICT_STRINGS, stringCount);
+    const uint64_t* offsets = mapped.section<uint64_t>(DICT_OFFSETS, offsetCount);
+    mapped.section<TermId>(DICT_TABLE, tableSize);
+    if (offsetCount == 0 || offsetCount - 1 > UINT32_MAX || offsets[0] != 0 || offsets[offsetCount - 1] != stringCount ||
+        tableSize == 0 || (tableSize & (tableSize - 1)) != 0) {
+        return false;
+    }
+
+    // PSO/POS：每层的 starts 比上一层的键多一项，最后一项等于下一层的键数
+    size_t tripleCounts[2];
+    SnapshotSection firstSections[2] = {PSO_KEYS0, POS_KEYS0};
+    for (int t = 0; t < 2; t++) {
+        size_t keyCounts[3], startCounts[2];
+        const uint32_t* starts[2];
+        mapped.section<TermId>(firstSections[t], keyCounts[0]);
+        starts[0] = mapped.section<uint32_t>(static_cast<SnapshotSection>(firstSections[t] + 1), startCounts[0]);
+        mapped.section<TermId>(static_cast<SnapshotSection>(firstSections[t] + 2), keyCounts[1]);
+        starts[1] = mapped.section<uint32_t>(static_cast<SnapshotSection>(firstSections[t] + 3), startCounts[1]);
+        mapped.section<TermId>(static_cast<SnapshotSection>(firstSections[t] + 4), keyCounts[2]);
+        if (startCounts[0] != keyCounts[0] + 1 || startCounts[1] != keyCounts[1] + 1 ||
+            starts[0][keyCounts[0]] != keyCounts[1] || starts[1][keyCounts[1]] != keyCounts[2]) {
+            return false;
+        }
+        tripleCounts[t] = keyCounts[2];
+    }
+    return tripleCounts[0] == tripleCounts[1];
+}
+
+void TripleStore::borrowTrie(Trie& trie, SnapshotSection firstSection) {
+    const TermId* keys[3];
+    size_t keyCounts[3];
+    const uint32_t* starts[2];
+    snapshotLevels(*snapshot, firstSection, keys, keyCounts, starts);
+    trie.loadLevels(keys, keyCounts, starts, true);
+}
+
+bool TripleStore::openSnapshot(const std::string& path, TripleStore* explicitFacts) {
+    if (!pinnedVersions.empty() || batchDepth != 0 ||
+        (explicitFacts != nullptr && !explicitFacts->pinnedVersions.empty())) {
+        return false;
+    }
+    // 所有段都校验通过后才替换当前内容，损坏的快照不会清空已有的存储
+    std::shared_ptr<MappedSnapshot> mapped = MappedSnapshot::open(path);
+    if (mapped == nullptr || !validSnapshot(*mapped)) {
+        return false;
+    }
+    clear();
+    snapshot = mapped;
+
+    size_t stringCount, offsetCount, tableSize;
+    const char* strings = snapshot->section<char>(DICT_STRINGS, stringCount);
+    const uint64_t* offsets = snapshot->section<uint64_t>(DICT_OFFSETS, offsetCount);
+    const TermId* table = snapshot->section<TermId>(DICT_TABLE, tableSize);
+    dictionary = std::make_shared<Dictionary>();
+    dictionary->attachMapped(snapshot, strings, offsets, static_cast<TermId>(offsetCount - 1), table, tableSize);
+
+    borrowTrie(triePSO, PSO_KEYS0);
+    borrowTrie(triePOS, POS_KEYS0);
+
+    // update: 主存储、哈希集合和多级索引不在快照中，也不再在这里重建，第一次修改或按主/谓/宾查询时由 materialize 建成
+    size_t keyCount;
+    snapshot->section<TermId>(PSO_KEYS2, keyCount);
+    lazyTriples = true;
+    lazyCount = keyCount;
+    if (allOrders) {
+        std::vector<IdTriple> all = getAllIdTriples();
+        buildTrie(trieSPO, all);
+        buildTrie(trieSOP, all);
+        buildTrie(trieOSP, all);
+        buildTrie(trieOPS, all);
+    }
+
+    if (explicitFacts != nullptr) {
+        explicitFacts->clear();
+        explicitFacts->dictionary = dictionary;
+        if (snapshot->flags() & SNAPSHOT_HAS_EXPLICIT_FACTS) {
+            size_t factCount;
+            const IdTriple* facts = snapshot->section<IdTriple>(EXPLICIT_FACTS, factCount);
+            for (size_t i = 0; i < factCount; i++) {
+                explicitFacts->addTriple(facts[i]);
+            }
+        } else {
+            forEachSnapshotTriple(Dictionary::NONE, [explicitFacts](const IdTriple& triple) {
+                explicitFacts->addTriple(triple);
+            });
+        }
+    }
+    return true;
+}
+
+void TripleStore::materialize() {
+    if (!lazyTriples) {
+        return;
+    }
+    lazyTriples = false;
+    lazyCount = 0;
+    const TermId* keys[3];
+    size_t keyCounts[3];
+    const uint32_t* starts[2];
+    snapshotLevels(*snapshot, PSO_KEYS0, keys, keyCounts, starts);
+    loadTriplesFromLevels(keys, keyCounts, starts);
+}
+
+template <typename Visit>
+void TripleStore::forEachSnapshotTriple(TermId predicate, Visit&& visit) const {
+    const TermId* keys[3];
+    size_t keyCounts[3];
+    const uint32_t* starts[2];
+    snapshotLevels(*snapshot, PSO_KEYS0, keys, keyCounts, starts);
+    size_t first = 0;
+    size_t last = keyCounts[0];
+    if (predicate != Dictionary::NONE) {
+        first = static_cast<size_t>(std::lower_bound(keys[0], keys[0] + keyCounts[0], predicate) - keys[0]);
+        last = first < keyCounts[0] && keys[0][first] == predicate ? first + 1 : first;
+    }
+    for (size_t i = first; i < last; i++) {
+        for (size_t j = starts[0][i]; j < starts[0][i + 1]; j++) {
+            for (size_t k = starts[1][j]; k < starts[1][j + 1]; k++) {
+                visit(IdTriple(keys[1][j], keys[0][i], keys[2][k]));
+            }
         }
-        node = node->children[key];
     }
-    return node;
-}
\ No newline at end of file
+}
+
+void TripleStore::loadTriplesFromLevels(const TermId* const keys[3], const size_t keyCounts[3],
+                                        const uint32_t* const starts[2]) {
+    triples.reserve(triples.size() + keyCounts[2]);
+    for (size_t i = 0; i < keyCounts[0]; i++) {
+        for (size_t j = starts[0][i]; j < starts[0][i + 1]; j++) {
+            for (size_t k = starts[1][j]; k < starts[1][j + 1]; k++) {
+                triples.emplace_back(keys[1][j], keys[0][i], keys[2][k]);
+            }
+        }
+    }
+    tripleSet.reserve(triples.size());
+    for (size_t index = 0; index < triples.size(); index++) {
+        tripleSet.insert(triples[index], static_cast<uint32_t>(index));
+    }
+    buildPostingLists();
+}
+
+void TripleStore::buildPostingLists() {
+    // ID 是稠密的，先用数组统计每个 ID 的出现次数，一次性预留哈希表和每个列表的空间，避免反复扩容
+    size_t idCount = dictionary->size() + 1;
+    std::vector<uint32_t> subjectCounts(idCount), predicateCounts(idCount), objectCounts(idCount);
+    for (const auto& triple : triples) {
+        subjectCounts[triple.subject]++;
+        predicateCounts[triple.predicate]++;
+        objectCounts[triple.object]++;
+    }
+    auto prepare = [idCount](std::unordered_map<TermId, std::vector<size_t>>& index,
+                             const std::vector<uint32_t>& counts) {
+        size_t distinct = 0;
+        for (size_t id = 1; id < idCount; id++) {
+            distinct += counts[id] != 0;
+        }
+        index.reserve(distinct);
+        for (size_t id = 1; id < idCount; id++) {
+            if (counts[id] != 0) {
+                index[static_cast<TermId>(id)].reserve(counts[id]);
+            }
+        }
+    };
+    prepare(subject_index, subjectCounts);
+    prepare(predicate_index, predicateCounts);
+    prepare(object_index, objectCounts);
+    for (size_t index = 0; index < triples.size(); index++) {
+        const IdTriple& triple = triples[index];
+        subject_index[triple.subject].push_back(index);
+        predicate_index[triple.predicate].push_back(index);
+        object_index[triple.object].push_back(index);
+    }
+}
+
+void TripleStore::buildTrie(Trie& trie, std::vector<IdTriple> triples) {
+    radixSort(triples, trie.order);
+    std::vector<TermId> keys[3];
+    std::vector<uint32_t> starts[2];
+    buildLevels(triples, trie.order, keys, starts);
+    const TermId* keyData[3] = {keys[0].data(), keys[1].data(), keys[2].data()};
+    const size_t keyCounts[3] = {keys[0].size(), keys[1].size(), keys[2].size()};
+    const uint32_t* startData[2] = {starts[0].data(), starts[1].data()};
+    trie.loadLevels(keyData, keyCounts, startData, false);
+}
+
+void TripleStore::bulkLoad(std::vector<Triple>&& input) {
+    std::vector<Triple> source = std::move(input);
+    // 整体重建会打乱主存储的顺序，固定的版本和进行中的批次依赖这个顺序
+    if (!pinnedVersions.empty() || batchDepth != 0) {
+        for (const auto& triple : source) {
+            addTriple(triple);
+        }
+        return;
+    }
+
+    // 第一步：并行地在每个分块内为出现的数据项分配局部编号（按首次出现的顺序）
+    size_t threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    threadCount = std::max<size_t>(1, std::min(threadCount, source.size() / BULK_CHUNK_MIN));
+    size_t chunkSize = (source.size() + threadCount - 1) / threadCount;
+    struct Chunk {
+        size_t begin = 0;
+        size_t end = 0;
+        std::vector<const std::string*> terms;  // 局部编号 -> 数据项
+        std::vector<uint32_t> localIds;         // 每个三元组三个局部编号
+        std::vector<TermId> globalIds;          // 局部编号 -> 词典 ID
+    };
+    std::vector<Chunk> chunks(threadCount);
+    std::vector<std::future<void>> futures;
+    for (size_t c = 0; c < threadCount; c++) {
+        chunks[c].begin = std::min(source.size(), c * chunkSize);
+        chunks[c].end = std::min(source.size(), (c + 1) * chunkSize);
+        futures.push_back(std::async(std::launch::async, [&source, &chunk = chunks[c]]() {
+            std::unordered_map<std::string_view, uint32_t> seen;
+            chunk.localIds.reserve((chunk.end - chunk.begin) * 3);
+            for (size_t i = chunk.begin; i < chunk.end; i++) {
+                for (const std::string* term : {&source[i].subject, &source[i].predicate, &source[i].object}) {
+                    auto result = seen.emplace(*term, static_cast<uint32_t>(chunk.terms.size()));
+                    if (result.second) {
+                        chunk.terms.push_back(term);
+                    }
+                    chunk.localIds.push_back(result.first->second);
+                }
+            }
+        }));
+    }
+    for (auto& future : futures) {
+        future.get();
+    }
+
+    // 第二步：按分块顺序把局部编号映射为词典 ID，与逐条 addTriple 得到的 ID 相同；只有这一步是串行的
+    for (auto& chunk : chunks) {
+        chunk.globalIds.reserve(chunk.terms.size());
+        for (const std::string* term : chunk.terms) {
+            chunk.globalIds.push_back(dictionary->encode(*term));
+        }
+    }
+
+    // 第三步：并行写出编码后的三元组，已有的三元组一起参与重建
+    std::vector<IdTriple> encoded = getAllIdTriples();
+    size_t base = encoded.size();
+    encoded.resize(base + source.size());
+    futures.clear();
+    for (auto& chunk : chunks) {
+        futures.push_back(std::async(std::launch::async, [&encoded, base, &chunk]() {
+            const uint32_t* local = chunk.localIds.data();
+            for (size_t i = chunk.begin; i < chunk.end; i++, local += 3) {
+                encoded[base + i] = IdTriple(chunk.globalIds[local[0]], chunk.globalIds[local[1]],
+                                             chunk.globalIds[local[2]]);
+            }
+        }));
+    }
+    for (auto& future : futures) {
+        future.get();
+    }
+    chunks.clear();
+    source.clear();
+    source.shrink_to_fit();
+
+    // 第四步：各顺序的 Trie 互不相关（各自有 arena），并行排序、去重并构建；PSO 的层数组同时用来填充主存储
+    clear();
+    std::vector<std::future<void>> builds;
+    std::vector<Trie*> others = {&triePOS};
+    if (allOrders) {
+        others.insert(others.end(), {&trieSPO, &trieSOP, &trieOSP, &trieOPS});
+    }
+    for (Trie* trie : others) {
+        builds.push_back(std::async(std::launch::async, [trie, copy = encoded]() mutable {
+            buildTrie(*trie, std::move(copy));
+        }));
+    }
+    radixSort(encoded, TrieOrder::PSO);
+    std::vector<TermId> keys[3];
+    std::vector<uint32_t> starts[2];
+    buildLevels(encoded, TrieOrder::PSO, keys, starts);
+    encoded.clear();
+    encoded.shrink_to_fit();
+    const TermId* keyData[3] = {keys[0].data(), keys[1].data(), keys[2].data()};
+    const size_t keyCounts[3] = {keys[0].size(), keys[1].size(), keys[2].size()};
+    const uint32_t* startData[2] = {starts[0].data(), starts[1].data()};
+    triePSO.loadLevels(keyData, keyCounts, startData, false);
+    loadTriplesFromLevels(keyData, keyCounts, startData);
+    for (auto& build : builds) {
+        build.get();
+    }
+}
@@ -1,42 +1,248 @@
 #ifndef RDFPANDA_STORAGE_TRIPLESTORE_H
 #define RDFPANDA_STORAGE_TRIPLESTORE_H
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <utility>
 #include <vector>
 #include <unordered_map>
 #include <string>
 
+#include "Dictionary.h"
+#include "Snapshot.h"
 #include "Trie.h"
+#include "TripleSet.h"
 
 //// Triple 和 Rule 类已定义在Trie.h中
 
+class TripleStore;
+
+// StoreVersion：TripleStore 某一时刻的只读版本，由 TripleStore::pinVersion() 得到
+// 版本存在期间事实库可以照常增删，版本看到的内容不变；最后一个副本析构后，只为它保留的历史被回收
+// 读取时持有事实库的共享锁，可以在其他线程推理或增量维护的同时使用；版本引用原事实库，不能比事实库存活得更久
+class StoreVersion {
+public:
+    StoreVersion() = default;
+    StoreVersion(const StoreVersion& other);
+    StoreVersion& operator=(const StoreVersion& other);
+    ~StoreVersion();
+
+    bool valid() const { return store != nullptr; }
+    bool contains(const IdTriple& triple) const;
+    // 返回与模式匹配的三元组，模式中为 NONE 的位置匹配任意 ID
+    std::vector<IdTriple> match(const IdTriple& pattern) const;
+    std::vector<IdTriple> getAllIdTriples() const;
+
+private:
+    friend class TripleStore;
+    const TripleStore* store = nullptr;
+    uint32_t version = 0;
+
+    // 调用方已持有事实库的独占锁
+    StoreVersion(const TripleStore* store, uint32_t version, const std::unique_lock<std::shared_mutex>& lock);
+};
+
 class TripleStore {
 private:
+    // 词典：加载时将所有 RDF 项编码为整数 ID，存储和索引内部只使用 ID
+    // 使用 shared_ptr：拷贝出的 TripleStore 与原对象共享同一词典，保证两者的 ID 一致
+    std::shared_ptr<Dictionary> dictionary;
+
     // 主存储：所有唯一的三元组
     // todo: 最初版本先使用vector满足基本功能需求，后续需要优化成更高效的数据结构
-    std::vector<Triple> triples;
+    // update: 删除时只把对应位置置为墓碑（全 NONE 的三元组），墓碑比例超过阈值后再整体压缩
+    std::vector<IdTriple> triples;
+    size_t tombstoneCount = 0;
+    static constexpr size_t COMPACTION_MIN_TOMBSTONES = 1024;
+    static constexpr double COMPACTION_TOMBSTONE_RATIO = 0.25;
     // update: 使用Trie树优化
-    Trie triePSO;
-    Trie triePOS;
+    // update: PSO/POS 按谓语垂直分区，每个谓语的子树有独立的 arena 和三元组计数，可以分别构建、压缩和释放
+    Trie triePSO{TrieOrder::PSO, true};
+    Trie triePOS{TrieOrder::POS, true};
+    // 可选的其余四种顺序，谓语为变量的规则需要它们才能对任意绑定模式做 leapfrog join，默认不维护
+    bool allOrders = false;
+    Trie trieSPO{TrieOrder::SPO};
+    Trie trieSOP{TrieOrder::SOP};
+    Trie trieOSP{TrieOrder::OSP};
+    Trie trieOPS{TrieOrder::OPS};
+
+    // 成员判定：哈希集合，查重不再走 Trie
+    TripleSet tripleSet;
 
     // 多级索引
-    // todo: 最初版本配合主存储的vector，使用unordered_map存储以某string作为主/谓/宾语的所有三元组在vector中的下标，之后需要配合主存储优化
-    std::unordered_map<std::string, std::vector<size_t>> subject_index;  // Subject → 主存储中的索引
-    std::unordered_map<std::string, std::vector<size_t>> predicate_index; // Predicate → 索引
-    std::unordered_map<std::string, std::vector<size_t>> object_index;    // Object → 索引
+    // todo: 最初版本配合主存储的vector，使用unordered_map存储以某ID作为主/谓/宾语的所有三元组在vector中的下标，之后需要配合主存储优化
+    std::unordered_map<TermId, std::vector<size_t>> subject_index;  // Subject → 主存储中的索引
+    std::unordered_map<TermId, std::vector<size_t>> predicate_index; // Predicate → 索引
+    std::unordered_map<TermId, std::vector<size_t>> object_index;    // Object → 索引
+
+    // 打开的快照文件，词典和 PSO/POS Trie 的键数组直接引用其映射区
+    std::shared_ptr<MappedSnapshot> snapshot;
+    // update: 打开快照时主存储、哈希集合和多级索引先不建，成员判断和遍历直接使用映射的 PSO Trie 和扁平数组；
+    // 第一次修改、按主/谓/宾查询或开始批次时再由 PSO 的扁平数组一次建成。未建时存储一定没有被修改过
+    bool lazyTriples = false;
+    size_t lazyCount = 0; // 未建时的三元组数
+
+    // 版本：主存储只在末尾追加（压缩保持相对顺序），所以一个版本只需记住固定时主存储的长度，
+    // 其中未被删除的三元组即为该版本可见的三元组。之后删除的、有版本可见的三元组在 retired 中记下可见的版本区间
+    // 版本由只读的查询方固定和释放，因此这些成员是 mutable 的
+    struct PinnedVersion {
+        size_t prefix;  // 固定时主存储的长度，压缩时同步调整
+        size_t refs;
+    };
+    static constexpr uint32_t OPEN_VERSION = UINT32_MAX; // 区间尚未结束（删除所在的批次还没有发布）
+    mutable uint32_t currentVersion = 0;
+    mutable std::map<uint32_t, PinnedVersion> pinnedVersions;
+    mutable std::unordered_map<IdTriple, std::vector<std::pair<uint32_t, uint32_t>>, IdTripleHash> retired; // 可见的版本闭区间
+    // retired 中的三元组按主语、谓语、宾语分组，有常量的查询只看与常量对应的历史
+    mutable std::unordered_map<TermId, std::vector<IdTriple>> retiredBySubject;
+    mutable std::unordered_map<TermId, std::vector<IdTriple>> retiredByPredicate;
+    mutable std::unordered_map<TermId, std::vector<IdTriple>> retiredByObject;
+    // update: 已结束的区间按结束版本排序（结束版本 -> (起始版本, 三元组)），释放版本时只检查可能因此失去可见版本的区间，
+    // 不再扫描整个 retired
+    mutable std::multimap<uint32_t, std::pair<uint32_t, IdTriple>> retiredByEnd;
+    // 批次：进行中时新固定的版本只能看到 publishedPrefix 之前、且在批次开始时未被删除的三元组
+    size_t batchDepth = 0;
+    size_t publishedPrefix = 0;
+    std::vector<IdTriple> batchRetired; // 本批次中删除、区间尚未结束的三元组
+
+    // 写入方修改时持有独占锁，版本的读取、固定和释放持有共享锁或独占锁
+    mutable std::shared_mutex mutex;
+
+    static bool isTombstone(const IdTriple& triple) { return triple.subject == Dictionary::NONE; }
+
+    // 清空全部三元组（保留词典）
+    void clear();
+    // 修改 this 之前校验快照的各段：词典段非空且自洽，PSO/POS 的层数组结构完整且三元组数相同
+    static bool validSnapshot(const MappedSnapshot& mapped);
+    // 取快照中从 firstSection 开始的一组层数组
+    static void snapshotLevels(const MappedSnapshot& mapped, SnapshotSection firstSection,
+                               const TermId* keys[3], size_t keyCounts[3], const uint32_t* starts[2]);
+    void borrowTrie(Trie& trie, SnapshotSection firstSection);
+    // 按 PSO 的扁平层数组顺序填充主存储，并重建哈希集合和多级索引
+    void loadTriplesFromLevels(const TermId* const keys[3], const size_t keyCounts[3], const uint32_t* const starts[2]);
+    // 打开快照后尚未建主存储时，由快照中 PSO 的层数组建成；调用方持有独占锁或没有并发的读取
+    void materialize();
+    // 按快照中 PSO 的顺序（即建成后主存储的顺序）访问三元组，predicate 不为 NONE 时只访问该谓语下的
+    template <typename Visit>
+    void forEachSnapshotTriple(TermId predicate, Visit&& visit) const;
+    // 由主存储一次性重建三个多级索引
+    void buildPostingLists();
+
+    friend class StoreVersion;
+    // 调用方持有独占锁
+    void pin(uint32_t version) const;
+    // 释放一个引用，版本不再被引用时回收只有它可见的历史
+    void unpin(uint32_t version) const;
+    // 区间 [first, last] 内是否还有固定的版本
+    bool retiredVisible(uint32_t first, uint32_t last) const;
+    // 回收结束版本在 [from, to) 内、已经没有固定版本能看到的区间
+    void pruneRetired(uint32_t from, uint32_t to) const;
+    // 从 retired 中移除三元组的一个区间，三元组没有剩余区间时一并移除
+    void dropRetired(const IdTriple& triple, const std::pair<uint32_t, uint32_t>& interval) const;
+    // 三元组从 retired 中移除时，同时从三个分组中移除
+    void unindexRetired(const IdTriple& triple) const;
+    // 删除主存储 index 处的三元组前调用，有固定的版本（或批次中之后固定的版本）能看到它时记入 retired
+    void retire(const IdTriple& triple, size_t index);
+    static bool retiredAt(const std::vector<std::pair<uint32_t, uint32_t>>& intervals, uint32_t version);
+    bool containsAt(const IdTriple& triple, uint32_t version) const;
+    std::vector<IdTriple> matchAt(const IdTriple& pattern, uint32_t version) const;
 
 public:
-    void addTriple(const Triple& triple);
+    TripleStore() : dictionary(std::make_shared<Dictionary>()) {}
+    // 需要保留某一时刻的内容时使用 pinVersion，不再整体拷贝
+    TripleStore(const TripleStore&) = delete;
+    TripleStore& operator=(const TripleStore&) = delete;
+
+    // 插入三元组，已存在时不做任何修改；返回是否为新三元组（只需一次哈希探测）
+    bool addTriple(const Triple& triple);
+    // 批量加载：并行编码，按 PSO/POS 顺序基数排序并去重，再自底向上一次性构建各层，
+    // 代替逐条 addTriple。store 中已有的三元组会与新三元组合并后整体重建；有固定的版本时改为逐条插入
+    void bulkLoad(std::vector<Triple>&& input);
+    bool addTriple(const IdTriple& triple);
     void deleteTriple(const Triple& triple);
+    void deleteTriple(const IdTriple& triple);
     std::vector<Triple> queryBySubject(const std::string& subject);
     std::vector<Triple> queryByPredicate(const std::string& predicate);
     std::vector<Triple> queryByObject(const std::string& object);
     std::vector<Triple> getAllTriples() const;
+    std::vector<IdTriple> getAllIdTriples() const;
 
-    TrieNode* getNodeByTriple(const Triple& triple) const;
+    // O(1) 判断三元组是否在事实库中；打开快照后尚未建哈希集合时在 PSO Trie 中查找
+    bool contains(const IdTriple& triple) const {
+        return lazyTriples ? triePSO.find(triple.predicate, triple.subject, triple.object) != nullptr : tripleSet.contains(triple);
+    }
+    size_t size() const { return lazyTriples ? lazyCount : tripleSet.size(); }
 
     TrieNode* getTriePSORoot() const { return triePSO.root; }
     TrieNode* getTriePOSRoot() const { return triePOS.root; }
+    // 返回指定顺序的 Trie 根节点，该顺序未维护时返回 nullptr
+    TrieNode* getTrieRoot(TrieOrder order) const;
+
+    // 谓语表：一个谓语在 PSO/POS 中的两棵子树，即按 (s,o) 和 (o,s) 排序的两组列
+    struct PredicateTable {
+        TermId predicate = Dictionary::NONE;
+        const TrieNode* bySubject = nullptr; // PSO 中谓语下的节点，键为主语
+        const TrieNode* byObject = nullptr;  // POS 中谓语下的节点，键为宾语
+        size_t size = 0;
+        size_t distinctSubjects = 0;
+        size_t distinctObjects = 0;
+    };
+    // 谓语不存在时返回 false
+    bool getPredicateTable(TermId predicate, PredicateTable& table) const;
+    // 按 ID 升序返回所有出现过的谓语
+    std::vector<TermId> getPredicates() const;
+
+    // 谓语的统计信息，随 addTriple/deleteTriple 增量维护，供连接顺序的代价估计使用
+    struct PredicateStats {
+        TermId predicate = Dictionary::NONE;
+        size_t size = 0;
+        FanoutStats perSubject; // 每个主语的宾语数，distinct 即不同主语数
+        FanoutStats perObject;  // 每个宾语的主语数，distinct 即不同宾语数
+    };
+    // 谓语不存在时返回 false
+    bool getPredicateStats(TermId predicate, PredicateStats& stats) const;
+
+    // 对三元组排序后自底向上构建 Trie，不逐条插入；trie 中原有的三元组被丢弃
+    static void buildTrie(Trie& trie, std::vector<IdTriple> triples);
+
+    // 开始维护全部六种顺序，并用已有三元组补建其余四棵 Trie
+    void enableAllOrders();
+    bool hasAllOrders() const { return allOrders; }
+
+    // 所有 Trie 的内存分配统计之和
+    ArenaStats getAllocationStats() const;
+    // 把各 Trie 叶层的键数组压缩为 PackedKeys，适合推理结束后长期只读的事实库；返回压缩的叶层节点数
+    size_t compressLeaves();
+
+    // 立即压缩主存储，清理所有墓碑
+    void compact();
+
+    // 以 O(1) 的代价固定当前内容（批次进行中时为上一批次发布后的内容），得到只读版本
+    StoreVersion pinVersion() const;
+
+    // 并发：事实库本身的方法不加锁。与版本读取并发的写入方把每次修改放在 lockExclusive() 之内，
+    // 并用 beginBatch/publishBatch 把一组修改包起来，这组修改对版本原子地可见；可以嵌套，最外层发布时生效
+    std::unique_lock<std::shared_mutex> lockExclusive() const { return std::unique_lock<std::shared_mutex>(mutex); }
+    std::shared_lock<std::shared_mutex> lockShared() const { return std::shared_lock<std::shared_mutex>(mutex); }
+    void beginBatch();
+    void publishBatch();
+
+    // 快照：词典和 PSO/POS 两棵 Trie 按页对齐写入文件，打开时只读 mmap，数据项和键数组在映射区中直接使用
+    // explicitFacts 不为空时表示本存储已包含推理结果，同时保存推理前的显式事实，重启后可直接做增量维护而无需重新 reason()
+    bool saveSnapshot(const std::string& path, const std::vector<IdTriple>* explicitFacts = nullptr) const;
+    // 打开快照并替换当前全部内容（包括词典）；explicitFacts 不为空时载入显式事实，
+    // 快照中没有单独保存显式事实时即为全部三元组。explicitFacts 与本存储共享词典
+    // 本存储或 explicitFacts 有固定的版本、或快照文件不完整时不能替换内容，返回 false 且原有内容不变
+    // 打开时 Trie 借用映射区，不逐个三元组重建主存储、哈希集合和多级索引，它们在第一次修改时才建
+    bool openSnapshot(const std::string& path, TripleStore* explicitFacts = nullptr);
+
+    // 编码/解码：字符串只在加载和输出时出现
+    Dictionary& getDictionary() { return *dictionary; }
+    const Dictionary& getDictionary() const { return *dictionary; }
+    IdTriple encode(const Triple& triple);
+    Triple decode(const IdTriple& triple) const;
 };
 
 
@@ -0,0 +1,329 @@
+#include "WriteAheadLog.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define WAL_OPEN(path) _open(path, _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, 0644)
+#define WAL_WRITE _write
+#define WAL_FSYNC _commit
+#define WAL_TRUNCATE _chsize_s
+#define WAL_CLOSE _close
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define WAL_OPEN(path) ::open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)
+#define WAL_WRITE ::write
+#define WAL_FSYNC ::fsync
+#define WAL_TRUNCATE ::ftruncate
+#define WAL_CLOSE ::close
+#endif
+
+namespace {
+constexpr size_t RECORD_HEADER_SIZE = 8; // 载荷长度 + CRC32
+
+uint32_t crc32(const char* data, size_t size) {
+    static uint32_t table[256] = {};
+    static bool initialized = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+template <typename T>
+void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool get(const std::string& in, size_t& pos, T& value) {
+    if (pos + sizeof(T) > in.size()) {
+        return false;
+    }
+    std::memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+void putTerm(std::string& out, const std::string& term) {
+    put<uint32_t>(out, static_cast<uint32_t>(term.size()));
+    out.append(term);
+}
+
+bool getTerm(const std::string& in, size_t& pos, std::string& term) {
+    uint32_t length;
+    if (!get(in, pos, length) || pos + length > in.size()) {
+        return false;
+    }
+    term.assign(in.data() + pos, length);
+    pos += length;
+    return true;
+}
+
+void putTriples(std::string& out, const std::vector<Triple>& triples) {
+    for (const auto& triple : triples) {
+        putTerm(out, triple.subject);
+        putTerm(out, triple.predicate);
+        putTerm(out, triple.object);
+    }
+}
+
+bool getTriples(const std::string& in, size_t& pos, uint32_t count, std::vector<Triple>& triples) {
+    std::string subject, predicate, object;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!getTerm(in, pos, subject) || !getTerm(in, pos, predicate) || !getTerm(in, pos, object)) {
+            return false;
+        }
+        triples.emplace_back(subject, predicate, object);
+    }
+    return true;
+}
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    close();
+}
+
+uint64_t WriteAheadLog::readRecords(std::vector<std::string>& payloads) const {
+    std::ifstream file(path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    while (pos + RECORD_HEADER_SIZE <= content.size()) {
+        uint32_t length, checksum;
+        std::memcpy(&length, content.data() + pos, sizeof(length));
+        std::memcpy(&checksum, content.data() + pos + 4, sizeof(checksum));
+        if (pos + RECORD_HEADER_SIZE + length > content.size() ||
+            crc32(content.data() + pos + RECORD_HEADER_SIZE, length) != checksum) {
+            break; // 崩溃时没写完的记录
+        }
+        payloads.emplace_back(content, pos + RECORD_HEADER_SIZE, length);
+        pos += RECORD_HEADER_SIZE + length;
+    }
+    return pos;
+}
+
+bool WriteAheadLog::open(const std::string& logPath) {
+    close();
+    path = logPath;
+
+    std::vector<std::string> payloads;
+    uint64_t validEnd = readRecords(payloads);
+    uint64_t lastSequence = 0;
+    if (!payloads.empty()) {
+        size_t pos = 0;
+        get(payloads.back(), pos, lastSequence);
+    }
+
+    fd = WAL_OPEN(path.c_str());
+    if (fd < 0) {
+        return false;
+    }
+    // 截掉末尾不完整的记录，之后追加的记录紧接在最后一条完整记录之后
+    if (WAL_TRUNCATE(fd, static_cast<long>(validEnd)) != 0) {
+        close();
+        return false;
+    }
+    nextSequence = lastSequence + 1;
+    pendingSequence = lastSequence;
+    writtenSequence = lastSequence;
+    failed = false;
+    dirty = false;
+    lastSync = std::chrono::steady_clock::now();
+    if (policy == FsyncPolicy::Interval) {
+        stopping = false;
+        flusher = std::thread(&WriteAheadLog::flushLoop, this);
+    }
+    return true;
+}
+
+void WriteAheadLog::close() {
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        flushWake.notify_all();
+        committed.notify_all();
+        flusher.join();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    committed.wait(lock, [this] { return !writing; });
+    if (fd >= 0) {
+        if (policy != FsyncPolicy::Never) {
+            syncFile();
+        }
+        dirty = false;
+        WAL_CLOSE(fd);
+        fd = -1;
+    }
+}
+
+void WriteAheadLog::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        // 组提交进行中时 lastSync 可能正在更新，等它结束
+        if (writing) {
+            committed.wait(lock);
+            continue;
+        }
+        // 有未落盘的记录时等到距上次 fsync 满 syncInterval，否则等一个完整的间隔再检查
+        if (dirty && !failed) {
+            flushWake.wait_until(lock, lastSync + syncInterval);
+        } else {
+            flushWake.wait_for(lock, syncInterval);
+        }
+        if (stopping || !dirty || writing || failed || std::chrono::steady_clock::now() - lastSync < syncInterval) {
+            continue;
+        }
+        // 与组提交一样标记 writing，fsync 期间不持有锁，append 可以继续积累记录
+        writing = true;
+        lock.unlock();
+        bool ok = syncFile();
+        lock.lock();
+        writing = false;
+        if (ok) {
+            dirty = false;
+        } else {
+            failed = true;
+        }
+        committed.notify_all();
+    }
+}
+
+bool WriteAheadLog::writeAll(const char* data, size_t size) {
+    while (size > 0) {
+        auto written = WAL_WRITE(fd, data, static_cast<unsigned>(size));
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool WriteAheadLog::syncFile() {
+    syncs++;
+    lastSync = std::chrono::steady_clock::now();
+    return WAL_FSYNC(fd) == 0;
+}
+
+uint64_t WriteAheadLog::append(const std::vector<Triple>& deletedTriples, const std::vector<Triple>& insertedTriples,
+                               MaintenancePath path) {
+    // 载荷中除序号外的部分在加锁前编码好
+    std::string body;
+    put<uint8_t>(body, static_cast<uint8_t>(path));
+    put<uint32_t>(body, static_cast<uint32_t>(deletedTriples.size()));
+    put<uint32_t>(body, static_cast<uint32_t>(insertedTriples.size()));
+    putTriples(body, deletedTriples);
+    putTriples(body, insertedTriples);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (fd < 0 || failed) {
+        return 0;
+    }
+    uint64_t sequence = nextSequence++;
+    std::string payload;
+    payload.reserve(sizeof(sequence) + body.size());
+    put<uint64_t>(payload, sequence);
+    payload.append(body);
+    put<uint32_t>(pending, static_cast<uint32_t>(payload.size()));
+    put<uint32_t>(pending, crc32(payload.data(), payload.size()));
+    pending.append(payload);
+    pendingSequence = sequence;
+
+    while (writtenSequence < sequence) {
+        if (failed) {
+            return 0;
+        }
+        if (writing) {
+            committed.wait(lock);
+            continue;
+        }
+        // 组提交：本线程把目前积累的所有记录一次写出，期间到达的记录留给下一次
+        writing = true;
+        std::string batch;
+        batch.swap(pending);
+        uint64_t batchSequence = pendingSequence;
+        lock.unlock();
+
+        bool ok = writeAll(batch.data(), batch.size());
+        bool synced = false;
+        if (ok && (policy == FsyncPolicy::Always ||
+                   (policy == FsyncPolicy::Interval && std::chrono::steady_clock::now() - lastSync >= syncInterval))) {
+            ok = synced = syncFile();
+        }
+
+        lock.lock();
+        writing = false;
+        groupCommits++;
+        if (ok) {
+            writtenSequence = batchSequence;
+            // 这次没有 fsync 时交给后台线程；fsync 同时覆盖之前写入的记录
+            dirty = !synced;
+        } else {
+            failed = true;
+        }
+        committed.notify_all();
+    }
+    return sequence;
+}
+
+bool WriteAheadLog::sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    committed.wait(lock, [this] { return !writing; });
+    if (fd < 0 || !syncFile()) {
+        return false;
+    }
+    dirty = false;
+    return true;
+}
+
+bool WriteAheadLog::reset() {
+    std::unique_lock<std::mutex> lock(mutex);
+    committed.wait(lock, [this] { return !writing; });
+    if (fd < 0) {
+        return false;
+    }
+    pending.clear();
+    writtenSequence = pendingSequence;
+    dirty = false;
+    return WAL_TRUNCATE(fd, 0) == 0 && syncFile();
+}
+
+bool WriteAheadLog::replay(const std::function<void(std::vector<Triple>&, std::vector<Triple>&, MaintenancePath)>& apply) const {
+    std::vector<std::string> payloads;
+    readRecords(payloads);
+    for (const auto& payload : payloads) {
+        size_t pos = 0;
+        uint64_t sequence;
+        uint8_t path;
+        uint32_t deletedCount, insertedCount;
+        if (!get(payload, pos, sequence) || !get(payload, pos, path) || path > static_cast<uint8_t>(MaintenancePath::CountingDRed) ||
+            !get(payload, pos, deletedCount) || !get(payload, pos, insertedCount)) {
+            return false;
+        }
+        std::vector<Triple> deletedTriples, insertedTriples;
+        if (!getTriples(payload, pos, deletedCount, deletedTriples) ||
+            !getTriples(payload, pos, insertedCount, insertedTriples)) {
+            return false;
+        }
+        apply(deletedTriples, insertedTriples, static_cast<MaintenancePath>(path));
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef RDFPANDA_STORAGE_WRITEAHEADLOG_H
+#define RDFPANDA_STORAGE_WRITEAHEADLOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Trie.h"
+
+// 日志何时调用 fsync
+enum class FsyncPolicy {
+    Always,    // 每次组提交后都 fsync，append 返回时批次已落盘
+    Interval,  // 距上次 fsync 超过 syncInterval 才 fsync，没有后续 append 时由后台线程补做，
+               // append 返回后最多 syncInterval 内落盘，崩溃时最多丢失这段时间内的批次；close 时也会 fsync
+    Never      // 只写入操作系统缓存，由操作系统决定何时落盘
+};
+
+// 批次在引擎中走的增量维护路径，重放时按同一路径执行，计数信息才能与事实库保持一致
+enum class MaintenancePath : uint8_t {
+    DRed = 0,         // DatalogEngine::leapfrogDRed
+    CountingDRed = 1  // DatalogEngine::leapfrogDRedCounting
+};
+
+// WriteAheadLog：显式事实增删批次的追加式日志
+// 每条记录为 [载荷长度 u32][载荷 CRC32 u32][载荷]，载荷为批次序号、维护路径和被删/插入的三元组（按字符串保存，
+// 与重启后词典分配的 ID 无关）。打开时从头校验，末尾不完整或校验失败的记录视为崩溃时未写完，直接截掉
+// 多个线程同时 append 时做组提交：先到的线程负责把所有等待中的记录一次写入并 fsync，其余线程等待它完成
+class WriteAheadLog {
+public:
+    explicit WriteAheadLog(FsyncPolicy policy = FsyncPolicy::Always,
+                           std::chrono::milliseconds syncInterval = std::chrono::milliseconds(100))
+            : policy(policy), syncInterval(syncInterval) {}
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+    ~WriteAheadLog();
+
+    // 打开日志文件，不存在时创建
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    // 追加一个批次，按 fsync 策略写入后返回其序号，失败时返回 0
+    uint64_t append(const std::vector<Triple>& deletedTriples, const std::vector<Triple>& insertedTriples,
+                    MaintenancePath path = MaintenancePath::DRed);
+    // 按写入顺序读出日志中的全部批次
+    bool replay(const std::function<void(std::vector<Triple>&, std::vector<Triple>&, MaintenancePath)>& apply) const;
+    // 立即 fsync
+    bool sync();
+    // 清空日志，在保存快照之后调用
+    bool reset();
+
+    uint64_t lastSequence() const { return nextSequence - 1; }
+    size_t groupCommitCount() const { return groupCommits; }
+    size_t syncCount() const { return syncs; }
+
+private:
+    FsyncPolicy policy;
+    std::chrono::milliseconds syncInterval;
+    std::string path;
+    int fd = -1;
+
+    std::mutex mutex;
+    std::condition_variable committed;
+    std::string pending;            // 等待写入的记录
+    uint64_t nextSequence = 1;
+    uint64_t pendingSequence = 0;   // pending 中最后一条记录的序号
+    uint64_t writtenSequence = 0;   // 已写入（并按策略落盘）的最后一个序号
+    bool writing = false;           // 是否有线程正在做组提交
+    bool failed = false;
+    bool dirty = false;             // 上次 fsync 之后是否写入过记录
+    std::chrono::steady_clock::time_point lastSync;
+    // Interval 策略下的后台线程：有未落盘的记录且距上次 fsync 已满 syncInterval 时 fsync
+    std::thread flusher;
+    std::condition_variable flushWake;
+    bool stopping = false;
+    size_t groupCommits = 0;
+    size_t syncs = 0;
+
+    // 从 path 读出所有完整记录的载荷，返回最后一条完整记录之后的文件偏移
+    uint64_t readRecords(std::vector<std::string>& payloads) const;
+    bool writeAll(const char* data, size_t size);
+    bool syncFile();
+    void flushLoop();
+};
+
+
+#endif //RDFPANDA_STORAGE_WRITEAHEADLOG_H
@@ -1,11 +1,41 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <new>
 #include <fstream>
 #include <string>
+#include <thread>
 
 #include "InputParser.h"
 #include "TripleStore.h"
 #include "DatalogEngine.h"
+#include "TaskScheduler.h"
+#include "ConcurrentTripleSet.h"
+
+//// 统计堆分配次数，用于验证 join 不分配内存
+// 替换全局 operator new 会让所有分配多一次原子操作，只在以 RDFPANDA_COUNT_ALLOCATIONS 编译时启用
+#ifdef RDFPANDA_COUNT_ALLOCATIONS
+static std::atomic<size_t> allocationCount(0);
+
+void* operator new(std::size_t size) {
+    allocationCount++;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
 
 //// 测试用，打印文件内容
 void printFileContent(const std::string& filename) {
@@ -258,9 +288,7 @@ void TestMillionTriples() {
     std::cout << "Elapsed time for parsing triples: " << elapsed.count() << " seconds" << std::endl;
 
     start = std::chrono::high_resolution_clock::now();
-    for (const auto& triple : triples) {
-        store.addTriple(triple);
-    }
+    store.bulkLoad(std::move(triples));
     end = std::chrono::high_resolution_clock::now();
     elapsed = end - start;
     std::cout << "Elapsed time for storing triples: " << elapsed.count() << " seconds" << std::endl;
@@ -279,6 +307,365 @@ void TestMillionTriples() {
     elapsed = end - start;
     std::cout << "Elapsed time for reasoning:       " << elapsed.count() << " seconds" << std::endl;
 
+    ArenaStats stats = store.getAllocationStats();
+    std::cout << "Trie memory: " << stats.reservedBytes << " bytes reserved in " << stats.blocks << " blocks, "
+              << stats.liveBytes << " bytes live, " << stats.allocations << " allocations ("
+              << stats.reusedAllocations << " reused, " << stats.frees << " freed)" << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    size_t compressed = store.compressLeaves();
+    end = std::chrono::high_resolution_clock::now();
+    elapsed = end - start;
+    stats = store.getAllocationStats();
+    std::cout << "Compressed " << compressed << " leaf nodes in " << elapsed.count() << " seconds, "
+              << stats.liveBytes << " bytes live" << std::endl;
+}
+
+//// 快照：推理后保存，重新打开时不需要解析输入文件和重新推理
+void TestSnapshot() {
+    InputParser parser;
+    TripleStore store;
+    std::vector<Triple> triples = parser.parseTurtle("../input_examples/mid-k.ttl");
+    for (const auto& triple : triples) {
+        store.addTriple(triple);
+    }
+    std::vector<Rule> rules = parser.parseDatalogFromFile("../input_examples/mid.dl");
+    DatalogEngine engine(store, rules);
+    engine.reason();
+    engine.saveSnapshot("mid.snapshot");
+
+    auto start = std::chrono::high_resolution_clock::now();
+    TripleStore reopened;
+    TripleStore explicitFacts;
+    if (!reopened.openSnapshot("mid.snapshot", &explicitFacts)) {
+        std::cout << "Failed to open snapshot" << std::endl;
+        return;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Elapsed time for opening snapshot: " << elapsed.count() << " seconds" << std::endl;
+    std::cout << "Triples: " << reopened.size() << ", explicit facts: " << explicitFacts.size() << std::endl;
+
+    // 重新打开后直接做增量维护
+    DatalogEngine reopenedEngine(reopened, rules, explicitFacts);
+    std::vector<Triple> deletedFacts(triples.begin(), triples.begin() + 10);
+    std::vector<Triple> insertedFacts;
+    reopenedEngine.leapfrogDRed(deletedFacts, insertedFacts);
+}
+
+void compareResults(const std::vector<Triple>& original, const std::vector<Triple>& newResult);
+
+//// 预写日志：快照之后的增删批次先写日志，重启时打开快照并重放日志
+void TestRecovery() {
+    InputParser parser;
+    TripleStore store;
+    std::vector<Triple> triples = parser.parseTurtle("../input_examples/DAG_1k.ttl");
+    for (const auto& triple : triples) {
+        store.addTriple(triple);
+    }
+    std::vector<Rule> rules = parser.parseDatalogFromFile("../input_examples/DAG-R.dl");
+    DatalogEngine engine(store, rules);
+    engine.reason();
+
+    WriteAheadLog log(FsyncPolicy::Always);
+    log.open("dag.wal");
+    engine.attachLog(&log);
+    engine.checkpoint("dag.snapshot");
+    std::vector<Triple> deletedFacts(triples.begin(), triples.begin() + 10);
+    std::vector<Triple> insertedFacts;
+    engine.leapfrogDRed(deletedFacts, insertedFacts);
+    log.close();
+
+    // 模拟重启
+    TripleStore recovered;
+    TripleStore explicitFacts;
+    recovered.openSnapshot("dag.snapshot", &explicitFacts);
+    DatalogEngine recoveredEngine(recovered, rules, explicitFacts);
+    WriteAheadLog recoveredLog;
+    recoveredLog.open("dag.wal");
+    recoveredEngine.recover(recoveredLog);
+    compareResults(store.getAllTriples(), recovered.getAllTriples());
+}
+
+//// 推理期间另一个线程固定版本并查询，只会看到推理前或推理完成后的事实库
+void TestConcurrentQueries() {
+    InputParser parser;
+    TripleStore store;
+    store.bulkLoad(parser.parseTurtle("../input_examples/DAG_1k.ttl"));
+    std::vector<Rule> rules = parser.parseDatalogFromFile("../input_examples/DAG-R.dl");
+    size_t explicitCount = store.size();
+
+    std::atomic<bool> done(false);
+    std::vector<size_t> counts;
+    std::thread reader([&]() {
+        while (!done) {
+            StoreVersion version = store.pinVersion();
+            counts.push_back(version.getAllIdTriples().size());
+        }
+    });
+    DatalogEngine engine(store, rules);
+    engine.reason();
+    done = true;
+    reader.join();
+
+    size_t inconsistent = 0;
+    for (size_t count : counts) {
+        if (count != explicitCount && count != store.size()) {
+            inconsistent++;
+        }
+    }
+    std::cout << "Concurrent queries: " << counts.size() << ", inconsistent: " << inconsistent << std::endl;
+}
+
+//// 测试按谓语分区的表：每个谓语的三元组数、不同主语数和不同宾语数
+void TestPredicateTables() {
+    InputParser parser;
+    TripleStore store;
+    store.bulkLoad(parser.parseTurtle("../input_examples/mid-k.ttl"));
+
+    size_t total = 0;
+    for (TermId predicate : store.getPredicates()) {
+        TripleStore::PredicateTable table;
+        store.getPredicateTable(predicate, table);
+        total += table.size;
+        std::cout << store.getDictionary().decode(predicate) << ": " << table.size << " triples, "
+                  << table.distinctSubjects << " subjects, " << table.distinctObjects << " objects" << std::endl;
+    }
+    std::cout << "Sum of tables: " << total << ", store size: " << store.size() << std::endl;
+}
+
+//// 测试谓语统计信息：删除一部分三元组后，增量维护的统计应与重新加载得到的一致
+void TestPredicateStats() {
+    InputParser parser;
+    std::vector<Triple> triples = parser.parseTurtle("../input_examples/mid-k.ttl");
+    TripleStore store;
+    for (const auto& triple : triples) {
+        store.addTriple(triple);
+    }
+    for (size_t i = 0; i < triples.size(); i += 3) {
+        store.deleteTriple(triples[i]);
+    }
+    TripleStore reloaded;
+    reloaded.bulkLoad(store.getAllTriples());
+
+    size_t mismatched = 0;
+    for (TermId predicate : store.getPredicates()) {
+        TripleStore::PredicateStats stats, expected;
+        store.getPredicateStats(predicate, stats);
+        reloaded.getPredicateStats(reloaded.getDictionary().lookup(std::string(store.getDictionary().decode(predicate))),
+                                   expected);
+        if (stats.size != expected.size || stats.perSubject.max != expected.perSubject.max ||
+            stats.perSubject.histogram != expected.perSubject.histogram ||
+            stats.perObject.max != expected.perObject.max || stats.perObject.histogram != expected.perObject.histogram) {
+            mismatched++;
+        }
+        std::cout << store.getDictionary().decode(predicate) << ": " << stats.size << " triples, objects per subject avg "
+                  << stats.perSubject.average << " max " << stats.perSubject.max << ", subjects per object avg "
+                  << stats.perObject.average << " max " << stats.perObject.max << std::endl;
+    }
+    std::cout << "Mismatched predicates: " << mismatched << std::endl;
+}
+
+//// 测试连接顺序与变量名无关：同一条规则换一组变量名，推理用时应当相近
+void TestVariableNaming() {
+    InputParser parser;
+    std::vector<Triple> triples = parser.parseTurtle("../input_examples/mid-k.ttl");
+    auto reasonWith = [&](const std::string& person, const std::string& organization, const std::string& city) {
+        TripleStore store;
+        store.bulkLoad(std::vector<Triple>(triples));
+        std::vector<Rule> rules;
+        rules.emplace_back(
+                "worksInCity",
+                std::vector<Triple>{
+                    {person, "http://example.org/worksAt", organization},
+                    {organization, "http://example.org/locatedIn", city},
+                },
+                Triple{person, "http://example.org/worksInCity", city}
+        );
+        auto start = std::chrono::high_resolution_clock::now();
+        DatalogEngine engine(store, rules);
+        engine.reason();
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        std::cout << person << " " << organization << " " << city << ": " << elapsed.count() << " seconds" << std::endl;
+    };
+    reasonWith("?X", "?O", "?C");
+    // 按字典序会先枚举 ?A 和 ?B 的笛卡尔积
+    reasonWith("?A", "?Z", "?B");
+}
+
+// 半朴素求值（reason）与逐个事实传播（reasonNaive）的结果应相同；DAG-R 中 path 的规则体有两个 path 模式，会跳过重复推导
+void TestSemiNaive() {
+    InputParser parser;
+    std::vector<Triple> triples = parser.parseTurtle("../input_examples/DAG_1k.ttl");
+    std::vector<Rule> rules = parser.parseDatalogFromFile("../input_examples/DAG-R.dl");
+    TripleStore semiNaiveStore, naiveStore;
+    semiNaiveStore.bulkLoad(std::vector<Triple>(triples));
+    naiveStore.bulkLoad(std::vector<Triple>(triples));
+    DatalogEngine semiNaive(semiNaiveStore, rules);
+    semiNaive.reason();
+    DatalogEngine naive(naiveStore, rules);
+    naive.reasonNaive();
+
+    std::vector<Triple> semiNaiveTriples = semiNaiveStore.getAllTriples();
+    std::vector<Triple> naiveTriples = naiveStore.getAllTriples();
+    std::sort(semiNaiveTriples.begin(), semiNaiveTriples.end());
+    std::sort(naiveTriples.begin(), naiveTriples.end());
+    std::cout << "semi-naive: " << semiNaiveTriples.size() << ", naive: " << naiveTriples.size()
+              << (semiNaiveTriples == naiveTriples ? " (same)" : " (MISMATCH)") << std::endl;
+}
+
+// odd 和 even 相互递归，应分在同一个递归分层中，与 reasonNaive 的结果相同
+void TestStratification() {
+    InputParser parser;
+    std::vector<Triple> triples = parser.parseTurtle("../input_examples/DAG_1k.ttl");
+    const std::string edge = "http://dag.org#edge", odd = "http://dag.org#odd", even = "http://dag.org#even";
+    std::vector<Rule> rules;
+    rules.emplace_back("oddBase", std::vector<Triple>{{"?X", edge, "?Y"}}, Triple{"?X", odd, "?Y"});
+    rules.emplace_back("even", std::vector<Triple>{{"?X", odd, "?Y"}, {"?Y", edge, "?Z"}}, Triple{"?X", even, "?Z"});
+    rules.emplace_back("odd", std::vector<Triple>{{"?X", even, "?Y"}, {"?Y", edge, "?Z"}}, Triple{"?X", odd, "?Z"});
+    rules.emplace_back("reachableOdd", std::vector<Triple>{{"?X", odd, "?Y"}}, Triple{"?X", "http://dag.org#reachable", "?Y"});
+    rules.emplace_back("reachableEven", std::vector<Triple>{{"?X", even, "?Y"}}, Triple{"?X", "http://dag.org#reachable", "?Y"});
+    TripleStore stratifiedStore, naiveStore;
+    stratifiedStore.bulkLoad(std::vector<Triple>(triples));
+    naiveStore.bulkLoad(std::vector<Triple>(triples));
+    DatalogEngine stratified(stratifiedStore, rules);
+    stratified.reason();
+    DatalogEngine naive(naiveStore, rules);
+    naive.reasonNaive();
+
+    std::vector<Triple> stratifiedTriples = stratifiedStore.getAllTriples();
+    std::vector<Triple> naiveTriples = naiveStore.getAllTriples();
+    std::sort(stratifiedTriples.begin(), stratifiedTriples.end());
+    std::sort(naiveTriples.begin(), naiveTriples.end());
+    std::cout << "stratified: " << stratifiedTriples.size() << ", naive: " << naiveTriples.size()
+              << (stratifiedTriples == naiveTriples ? " (same)" : " (MISMATCH)") << std::endl;
+}
+
+// 任务在执行中继续提交子任务，wait 应在所有任务（含子任务）完成后才返回
+void TestTaskScheduler() {
+    TaskScheduler scheduler(4);
+    TaskScheduler::TaskGroup group;
+    std::atomic<size_t> executed(0);
+    std::function<void(size_t)> spawn = [&](size_t depth) {
+        executed++;
+        if (depth < 10) {
+            scheduler.submit(group, [&, depth](size_t) { spawn(depth + 1); });
+            scheduler.submit(group, [&, depth](size_t) { spawn(depth + 1); });
+        }
+    };
+    scheduler.submit(group, [&](size_t) { spawn(0); });
+    scheduler.wait(group);
+    std::cout << "executed " << executed.load() << " tasks (expected " << (1 << 11) - 1 << ")" << std::endl;
+}
+
+// 多个线程插入大量重叠的三元组，每个三元组应恰好有一个线程插入成功，期间集合多次扩容
+void TestConcurrentTripleSet() {
+    ConcurrentTripleSet set;
+    const int threadCount = 8;
+    const uint32_t distinct = 200000;
+    std::atomic<size_t> wins(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t]() {
+            for (uint32_t i = 0; i < distinct; i++) {
+                uint32_t n = (i * 7919 + t * 104729) % distinct; // 各线程以不同顺序插入同一组三元组
+                if (set.insert(IdTriple(n % 1000 + 1, n / 1000 + 1, n + 1))) {
+                    wins++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    bool allFound = true;
+    for (uint32_t n = 0; n < distinct; n++) {
+        allFound = allFound && set.contains(IdTriple(n % 1000 + 1, n / 1000 + 1, n + 1));
+    }
+    std::cout << "wins " << wins.load() << ", size " << set.size() << " (expected " << distinct << ")"
+              << (allFound && !set.contains(IdTriple(1, 1, distinct + 1)) ? "" : " LOOKUP FAILED") << std::endl;
+}
+
+// 把最外层变量分段并行执行的 join 与单线程的结果应相同（顺序可能不同）
+void TestMorselJoin() {
+    InputParser parser;
+    TaskScheduler scheduler(4);
+    for (const auto& [data, rulesFile] : {std::make_pair("DAG_10k.ttl", "DAG-R.dl"), std::make_pair("mid-k.ttl", "mid.dl")}) {
+        TripleStore store;
+        store.bulkLoad(parser.parseTurtle(std::string("../input_examples/") + data));
+        std::vector<Rule> rules = parser.parseDatalogFromFile(std::string("../input_examples/") + rulesFile);
+        DatalogEngine engine(store, rules);
+        size_t mismatched = 0;
+        for (size_t i = 0; i < engine.ruleCount(); i++) {
+            std::vector<IdTriple> serial, parallel;
+            engine.evaluateRule(i, serial);
+            engine.evaluateRule(i, parallel, scheduler);
+            std::sort(serial.begin(), serial.end());
+            std::sort(parallel.begin(), parallel.end());
+            mismatched += serial != parallel;
+        }
+        std::cout << data << ": " << engine.ruleCount() << " rules, " << mismatched << " mismatched" << std::endl;
+    }
+}
+
+// 触发事实按批 join 的增量维护：删除部分显式事实后，结果应与在剩余事实上重新推理相同
+void TestBatchedTriggers() {
+    InputParser parser;
+    std::vector<Triple> triples = parser.parseTurtle("../input_examples/DAG_10k.ttl");
+    std::vector<Rule> rules = parser.parseDatalogFromFile("../input_examples/DAG-R.dl");
+    std::vector<Triple> deleted, inserted, remaining;
+    for (size_t i = 0; i < triples.size(); i++) {
+        (i % 7 == 0 ? deleted : remaining).push_back(triples[i]);
+    }
+    TripleStore maintainedStore, freshStore;
+    maintainedStore.bulkLoad(std::vector<Triple>(triples));
+    freshStore.bulkLoad(std::move(remaining));
+    DatalogEngine maintained(maintainedStore, rules);
+    maintained.reasonNaive();
+    maintained.leapfrogDRed(deleted, inserted);
+    DatalogEngine fresh(freshStore, rules);
+    fresh.reasonNaive();
+
+    std::vector<Triple> maintainedTriples = maintainedStore.getAllTriples();
+    std::vector<Triple> freshTriples = freshStore.getAllTriples();
+    std::sort(maintainedTriples.begin(), maintainedTriples.end());
+    std::sort(freshTriples.begin(), freshTriples.end());
+    std::cout << "DRed: " << maintainedTriples.size() << ", fresh: " << freshTriples.size()
+              << (maintainedTriples == freshTriples ? " (same)" : " (MISMATCH)") << std::endl;
+}
+
+//// 微基准：预热后反复对每条规则做完整的 join，统计耗时和堆分配次数（应为 0）
+void BenchmarkJoinAllocations() {
+    InputParser parser;
+    TripleStore store;
+    store.bulkLoad(parser.parseTurtle("../input_examples/mid-k.ttl"));
+    std::vector<Rule> rules = parser.parseDatalogFromFile("../input_examples/mid.dl");
+    DatalogEngine engine(store, rules);
+
+    std::vector<IdTriple> newFacts;
+    for (size_t i = 0; i < engine.ruleCount(); i++) {
+        engine.evaluateRule(i, newFacts); // 预热：工作区和 newFacts 扩容到所需大小
+    }
+    const int rounds = 100;
+    size_t derived = 0;
+#ifdef RDFPANDA_COUNT_ALLOCATIONS
+    size_t allocationsBefore = allocationCount.load();
+#endif
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < engine.ruleCount(); i++) {
+            newFacts.clear();
+            engine.evaluateRule(i, newFacts);
+            derived += newFacts.size();
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Rule evaluations: " << rounds * engine.ruleCount() << ", derived: " << derived
+              << ", time: " << elapsed.count() << " seconds";
+#ifdef RDFPANDA_COUNT_ALLOCATIONS
+    std::cout << ", heap allocations: " << allocationCount.load() - allocationsBefore;
+#endif
+    std::cout << std::endl;
 }
 
 //// 计时用